@@ -0,0 +1,195 @@
+#pragma once
+
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+
+// Move-only owners for GL objects, deleting them when they go out of scope.
+// Every handle updates gpuResources so live objects and their approximate
+// GPU bytes can be watched while running.
+
+enum GpuResourceKind {
+	GPU_BUFFER,
+	GPU_VERTEX_ARRAY,
+	GPU_TEXTURE,
+	GPU_PROGRAM,
+	GPU_FRAMEBUFFER,
+	GPU_RESOURCE_KINDS
+};
+
+struct GpuResourceCounters {
+	long live[GPU_RESOURCE_KINDS] = {};
+	long long bytes[GPU_RESOURCE_KINDS] = {};
+	long created = 0;
+	long destroyed = 0;
+
+	long long totalBytes() const
+	{
+		long long total = 0;
+		for (int i = 0; i < GPU_RESOURCE_KINDS; i++)
+			total += bytes[i];
+		return total;
+	}
+};
+
+inline GpuResourceCounters gpuResources;
+
+inline const char* gpuResourceName(int kind)
+{
+	switch (kind)
+	{
+	case GPU_BUFFER: return "Buffers";
+	case GPU_VERTEX_ARRAY: return "Vertex arrays";
+	case GPU_TEXTURE: return "Textures";
+	case GPU_PROGRAM: return "Programs";
+	case GPU_FRAMEBUFFER: return "Framebuffers";
+	default: return "Unknown";
+	}
+}
+
+inline void deleteGLBuffer(GLuint id)
+{
+	glState.deletedBuffer(id);
+	glDeleteBuffers(1, &id);
+}
+
+inline void deleteGLVertexArray(GLuint id)
+{
+	glState.deletedVertexArray(id);
+	glDeleteVertexArrays(1, &id);
+}
+
+inline void deleteGLTexture(GLuint id)
+{
+	glState.deletedTexture(id);
+	glDeleteTextures(1, &id);
+}
+
+inline void deleteGLProgram(GLuint id)
+{
+	glState.deletedProgram(id);
+	glDeleteProgram(id);
+}
+
+inline void deleteGLFramebuffer(GLuint id)
+{
+	glState.deletedFramebuffer(id);
+	glDeleteFramebuffers(1, &id);
+}
+
+template <GpuResourceKind Kind, void (*Delete)(GLuint)>
+class GLHandle {
+public:
+	GLHandle() = default;
+
+	// Takes ownership of an already generated object, 0 stays empty
+	explicit GLHandle(GLuint a_id) : id(a_id)
+	{
+		if (id)
+		{
+			gpuResources.live[Kind]++;
+			gpuResources.created++;
+		}
+	}
+
+	GLHandle(const GLHandle&) = delete;
+	GLHandle& operator=(const GLHandle&) = delete;
+
+	GLHandle(GLHandle&& other) noexcept : id(other.id), bytes(other.bytes)
+	{
+		other.id = 0;
+		other.bytes = 0;
+	}
+
+	GLHandle& operator=(GLHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			id = other.id;
+			bytes = other.bytes;
+			other.id = 0;
+			other.bytes = 0;
+		}
+		return *this;
+	}
+
+	~GLHandle() { reset(); }
+
+	void reset()
+	{
+		if (id)
+		{
+			Delete(id);
+			gpuResources.live[Kind]--;
+			gpuResources.bytes[Kind] -= bytes;
+			gpuResources.destroyed++;
+		}
+		id = 0;
+		bytes = 0;
+	}
+
+	// Estimated GPU storage owned by this object, replaces the previous estimate
+	void setBytes(long long a_bytes)
+	{
+		gpuResources.bytes[Kind] += a_bytes - bytes;
+		bytes = a_bytes;
+	}
+
+	GLuint get() const { return id; }
+	long long size() const { return bytes; }
+	operator GLuint() const { return id; }
+
+private:
+	GLuint id = 0;
+	long long bytes = 0;
+};
+
+using GLBuffer = GLHandle<GPU_BUFFER, deleteGLBuffer>;
+using GLVertexArray = GLHandle<GPU_VERTEX_ARRAY, deleteGLVertexArray>;
+using GLTexture = GLHandle<GPU_TEXTURE, deleteGLTexture>;
+using GLProgram = GLHandle<GPU_PROGRAM, deleteGLProgram>;
+using GLFramebuffer = GLHandle<GPU_FRAMEBUFFER, deleteGLFramebuffer>;
+
+inline GLBuffer createGLBuffer()
+{
+	GLuint id = 0;
+	glGenBuffers(1, &id);
+	return GLBuffer(id);
+}
+
+inline GLVertexArray createGLVertexArray()
+{
+	GLuint id = 0;
+	glGenVertexArrays(1, &id);
+	return GLVertexArray(id);
+}
+
+inline GLTexture createGLTexture()
+{
+	GLuint id = 0;
+	glGenTextures(1, &id);
+	return GLTexture(id);
+}
+
+inline GLFramebuffer createGLFramebuffer()
+{
+	GLuint id = 0;
+	glGenFramebuffers(1, &id);
+	return GLFramebuffer(id);
+}
+
+// Bind and fill a buffer, recording its size
+inline void uploadBuffer(GLBuffer& buffer, GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	glState.bindBuffer(target, buffer);
+	glBufferData(target, size, data, usage);
+	buffer.setBytes(size);
+}
+
+// Storage of a 2D image, a full mip chain adds about a third
+inline long long textureBytes(int width, int height, int bytesPerPixel, bool mipmapped)
+{
+	long long base = static_cast<long long>(width) * height * bytesPerPixel;
+	return mipmapped ? base * 4 / 3 : base;
+}
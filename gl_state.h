@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <GLES3/gl3.h>
+
+#include "stats.h"
+
+// Last value set for each piece of GL state the renderer changes, so calls setting what
+// is already current never reach GL. Under WebGL every call crosses into JavaScript,
+// a filtered one costs a compare. Binds and toggles all go through glState, code calling
+// GL behind its back has to invalidate() it afterwards.
+// GL_ELEMENT_ARRAY_BUFFER belongs to the bound vertex array, it is passed through untracked.
+
+class GLStateCache {
+public:
+	static const int TEXTURE_UNITS = 16;
+
+	GLStateCache() { invalidate(); }
+
+	void useProgram(GLuint program)
+	{
+		if (changed(program, currentProgram))
+			glUseProgram(program);
+	}
+
+	void bindVertexArray(GLuint vertexArray)
+	{
+		if (changed(vertexArray, currentVertexArray))
+			glBindVertexArray(vertexArray);
+	}
+
+	void bindBuffer(GLenum target, GLuint buffer)
+	{
+		int slot = bufferSlot(target);
+		if (slot < 0)
+		{
+			issue();
+			glBindBuffer(target, buffer);
+		}
+		else if (changed(buffer, buffers[slot]))
+		{
+			glBindBuffer(target, buffer);
+		}
+	}
+
+	// Also binds the generic target, as GL does
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+	{
+		issue();
+		glBindBufferBase(target, index, buffer);
+		int slot = bufferSlot(target);
+		if (slot >= 0)
+			buffers[slot] = buffer;
+	}
+
+	void activeTexture(GLenum unit)
+	{
+		if (changed(unit, currentUnit))
+			glActiveTexture(unit);
+	}
+
+	// On the active unit
+	void bindTexture(GLenum target, GLuint texture)
+	{
+		int unit = static_cast<int>(currentUnit - GL_TEXTURE0);
+		int slot = textureSlot(target);
+		if (slot < 0 || currentUnit == UNKNOWN || unit >= TEXTURE_UNITS)
+		{
+			issue();
+			glBindTexture(target, texture);
+		}
+		else if (changed(texture, textures[unit][slot]))
+		{
+			glBindTexture(target, texture);
+		}
+	}
+
+	// Both in one, the way draws bind their samplers
+	void bindTexture(GLenum unit, GLenum target, GLuint texture)
+	{
+		activeTexture(unit);
+		bindTexture(target, texture);
+	}
+
+	void setEnabled(GLenum capability, bool enabled)
+	{
+		int slot = capabilitySlot(capability);
+		GLuint value = enabled ? 1 : 0;
+		if (slot >= 0 && !changed(value, capabilities[slot]))
+			return;
+		if (slot < 0)
+			issue();
+		if (enabled)
+			glEnable(capability);
+		else
+			glDisable(capability);
+	}
+
+	// GL_FRAMEBUFFER, draw and read together
+	void bindFramebuffer(GLuint framebuffer)
+	{
+		if (changed(framebuffer, currentFramebuffer))
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
+	void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		GLint value[4] = { x, y, width, height };
+		if (std::equal(value, value + 4, currentViewport))
+		{
+			frameStats.glStateFiltered++;
+			return;
+		}
+		issue();
+		std::copy(value, value + 4, currentViewport);
+		glViewport(x, y, width, height);
+	}
+
+	// Only applies while GL_SCISSOR_TEST is enabled
+	void scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+	{
+		GLint value[4] = { x, y, width, height };
+		if (std::equal(value, value + 4, currentScissor))
+		{
+			frameStats.glStateFiltered++;
+			return;
+		}
+		issue();
+		std::copy(value, value + 4, currentScissor);
+		glScissor(x, y, width, height);
+	}
+
+	void blendFunc(GLenum source, GLenum destination)
+	{
+		if (source == blendSource && destination == blendDestination)
+		{
+			frameStats.glStateFiltered++;
+			return;
+		}
+		issue();
+		blendSource = source;
+		blendDestination = destination;
+		glBlendFunc(source, destination);
+	}
+
+	void depthFunc(GLenum function)
+	{
+		if (changed(function, currentDepthFunc))
+			glDepthFunc(function);
+	}
+
+	void depthMask(bool write)
+	{
+		if (changed(write ? 1 : 0, currentDepthMask))
+			glDepthMask(write ? GL_TRUE : GL_FALSE);
+	}
+
+	void cullFace(GLenum mode)
+	{
+		if (changed(mode, currentCullFace))
+			glCullFace(mode);
+	}
+
+	// Called as objects are deleted, GL unbinds them and their names can come back
+	void deletedBuffer(GLuint buffer)
+	{
+		for (GLuint& bound : buffers)
+			bound = bound == buffer ? 0 : bound;
+	}
+
+	void deletedVertexArray(GLuint vertexArray)
+	{
+		if (currentVertexArray == vertexArray)
+			currentVertexArray = 0;
+	}
+
+	void deletedTexture(GLuint texture)
+	{
+		for (auto& unit : textures)
+		{
+			for (GLuint& bound : unit)
+				bound = bound == texture ? 0 : bound;
+		}
+	}
+
+	void deletedFramebuffer(GLuint framebuffer)
+	{
+		if (currentFramebuffer == framebuffer)
+			currentFramebuffer = 0;
+	}
+
+	// A current program stays in use until replaced, its name is not reused before then
+	void deletedProgram(GLuint program) { (void)program; }
+
+	// Forgets everything, the next call of each kind always reaches GL
+	void invalidate()
+	{
+		currentProgram = UNKNOWN;
+		currentVertexArray = UNKNOWN;
+		currentUnit = UNKNOWN;
+		currentFramebuffer = UNKNOWN;
+		// No viewport or scissor box has a negative size
+		std::fill(currentViewport, currentViewport + 4, -1);
+		std::fill(currentScissor, currentScissor + 4, -1);
+		for (GLuint& bound : buffers)
+			bound = UNKNOWN;
+		for (auto& unit : textures)
+		{
+			for (GLuint& bound : unit)
+				bound = UNKNOWN;
+		}
+		for (GLuint& enabled : capabilities)
+			enabled = UNKNOWN;
+		blendSource = UNKNOWN;
+		blendDestination = UNKNOWN;
+		currentDepthFunc = UNKNOWN;
+		currentDepthMask = UNKNOWN;
+		currentCullFace = UNKNOWN;
+	}
+
+private:
+	static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+	GLuint currentProgram;
+	GLuint currentVertexArray;
+	GLuint currentUnit;
+	GLuint currentFramebuffer;
+	GLint currentViewport[4];
+	GLint currentScissor[4];
+	// ARRAY, UNIFORM, PIXEL_UNPACK, COPY_READ and COPY_WRITE buffers
+	GLuint buffers[5];
+	// 2D, CUBE_MAP, 2D_ARRAY and 3D per unit
+	GLuint textures[TEXTURE_UNITS][4];
+	// BLEND, DEPTH_TEST, CULL_FACE and SCISSOR_TEST
+	GLuint capabilities[4];
+	GLuint blendSource;
+	GLuint blendDestination;
+	GLuint currentDepthFunc;
+	GLuint currentDepthMask;
+	GLuint currentCullFace;
+
+	// True and recorded when value differs from current, counted either way
+	static bool changed(GLuint value, GLuint& current)
+	{
+		if (value == current)
+		{
+			frameStats.glStateFiltered++;
+			return false;
+		}
+		current = value;
+		issue();
+		return true;
+	}
+
+	static void issue()
+	{
+		frameStats.glStateIssued++;
+		frameStats.glCalls++;
+	}
+
+	static int bufferSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_ARRAY_BUFFER: return 0;
+		case GL_UNIFORM_BUFFER: return 1;
+		case GL_PIXEL_UNPACK_BUFFER: return 2;
+		case GL_COPY_READ_BUFFER: return 3;
+		case GL_COPY_WRITE_BUFFER: return 4;
+		default: return -1;
+		}
+	}
+
+	static int textureSlot(GLenum target)
+	{
+		switch (target)
+		{
+		case GL_TEXTURE_2D: return 0;
+		case GL_TEXTURE_CUBE_MAP: return 1;
+		case GL_TEXTURE_2D_ARRAY: return 2;
+		case GL_TEXTURE_3D: return 3;
+		default: return -1;
+		}
+	}
+
+	static int capabilitySlot(GLenum capability)
+	{
+		switch (capability)
+		{
+		case GL_BLEND: return 0;
+		case GL_DEPTH_TEST: return 1;
+		case GL_CULL_FACE: return 2;
+		case GL_SCISSOR_TEST: return 3;
+		default: return -1;
+		}
+	}
+};
+
+inline GLStateCache glState;
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+#include "vertex.h"
+
+// Large shared vertex and index buffers that static meshes sub-allocate from.
+// Pools are keyed by vertex format and index type, each pool has a single VAO so
+// every mesh living in it draws with the same vertex array bound.
+// WebGL2 has no base vertex draws, indices are rebased on the allocation when
+// uploaded, which is why 16-bit pools never hold more than 65536 vertices.
+
+// First fit free-list over [0, capacity), freed ranges are merged with their neighbours
+class RangeAllocator {
+public:
+	RangeAllocator() = default;
+	explicit RangeAllocator(GLsizei a_capacity) : capacity(a_capacity)
+	{
+		freeRanges.push_back({ 0, capacity });
+	}
+
+	// Returns the offset of the range, or -1 when nothing large enough is free
+	GLsizei allocate(GLsizei size)
+	{
+		for (size_t i = 0; i < freeRanges.size(); i++)
+		{
+			if (freeRanges[i].size < size)
+				continue;
+
+			GLsizei offset = freeRanges[i].offset;
+			freeRanges[i].offset += size;
+			freeRanges[i].size -= size;
+			if (freeRanges[i].size == 0)
+				freeRanges.erase(freeRanges.begin() + i);
+			used += size;
+			return offset;
+		}
+		return -1;
+	}
+
+	void release(GLsizei offset, GLsizei size)
+	{
+		if (size <= 0)
+			return;
+
+		auto next = std::lower_bound(freeRanges.begin(), freeRanges.end(), offset,
+			[](const Range& range, GLsizei value) { return range.offset < value; });
+		next = freeRanges.insert(next, { offset, size });
+		used -= size;
+
+		// Merge with the following range then with the previous one
+		if (next + 1 != freeRanges.end() && next->offset + next->size == (next + 1)->offset)
+		{
+			next->size += (next + 1)->size;
+			freeRanges.erase(next + 1);
+		}
+		if (next != freeRanges.begin() && (next - 1)->offset + (next - 1)->size == next->offset)
+		{
+			(next - 1)->size += next->size;
+			freeRanges.erase(next);
+		}
+	}
+
+	GLsizei capacity = 0;
+	GLsizei used = 0;
+
+	size_t fragments() const { return freeRanges.size(); }
+
+private:
+	struct Range {
+		GLsizei offset;
+		GLsizei size;
+	};
+	std::vector<Range> freeRanges;
+};
+
+// Where a mesh lives in the arena, offsets are in vertices and indices
+struct ArenaAllocation {
+	int pool = -1;
+	GLsizei firstVertex = 0;
+	GLsizei vertexCount = 0;
+	GLsizei firstIndex = 0;
+	GLsizei indexCount = 0;
+};
+
+class GpuArena {
+public:
+	// Default pool sizes, a mesh larger than these gets a pool of its own size
+	GLsizei largePoolVertices = 1 << 18;
+	GLsizei poolIndices = 1 << 19;
+
+	// vertexData must already be in the layout of format, indices are local to the mesh
+	ArenaAllocation allocate(VertexFormat format, const void* vertexData, GLsizei vertexCount,
+		const std::vector<GLuint>& indices)
+	{
+		return allocate(format, vertexData, vertexCount, GL_UNSIGNED_INT, indices.data(), static_cast<GLsizei>(indices.size()));
+	}
+
+	// Same with indices of sourceType, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, as read from a baked model
+	ArenaAllocation allocate(VertexFormat format, const void* vertexData, GLsizei vertexCount,
+		GLenum sourceType, const void* indexData, GLsizei indexCount)
+	{
+		ArenaAllocation allocation;
+		GLenum indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+		for (size_t p = 0; p < pools.size() && allocation.pool < 0; p++)
+		{
+			Pool& pool = pools[p];
+			if (pool.format != format || pool.indexType != indexType)
+				continue;
+
+			GLsizei firstVertex = pool.vertexRanges.allocate(vertexCount);
+			if (firstVertex < 0)
+				continue;
+			GLsizei firstIndex = pool.indexRanges.allocate(indexCount);
+			if (firstIndex < 0)
+			{
+				pool.vertexRanges.release(firstVertex, vertexCount);
+				continue;
+			}
+
+			allocation.pool = static_cast<int>(p);
+			allocation.firstVertex = firstVertex;
+			allocation.firstIndex = firstIndex;
+		}
+
+		if (allocation.pool < 0)
+		{
+			GLsizei vertexCapacity = indexType == GL_UNSIGNED_SHORT ? 65536 : std::max(largePoolVertices, vertexCount);
+			allocation.pool = createPool(format, indexType, vertexCapacity, std::max(poolIndices, indexCount));
+			allocation.firstVertex = pools[allocation.pool].vertexRanges.allocate(vertexCount);
+			allocation.firstIndex = pools[allocation.pool].indexRanges.allocate(indexCount);
+		}
+
+		allocation.vertexCount = vertexCount;
+		allocation.indexCount = indexCount;
+
+		Pool& pool = pools[allocation.pool];
+		GLsizei stride = vertexStride(format);
+
+		glState.bindVertexArray(pool.vao);
+		glState.bindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, static_cast<GLintptr>(allocation.firstVertex) * stride,
+			static_cast<GLsizeiptr>(vertexCount) * stride, vertexData);
+
+		// Rebase indices on the first vertex of the allocation
+		GLuint base = static_cast<GLuint>(allocation.firstVertex);
+		const GLushort* shortSource = static_cast<const GLushort*>(indexData);
+		const GLuint* intSource = static_cast<const GLuint*>(indexData);
+		auto sourceIndex = [&](GLsizei i) { return sourceType == GL_UNSIGNED_SHORT ? GLuint(shortSource[i]) : intSource[i]; };
+
+		if (indexType == GL_UNSIGNED_SHORT)
+		{
+			std::vector<GLushort> rebased(indexCount);
+			for (GLsizei i = 0; i < indexCount; i++)
+				rebased[i] = static_cast<GLushort>(sourceIndex(i) + base);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(allocation.firstIndex) * sizeof(GLushort),
+				rebased.size() * sizeof(GLushort), rebased.data());
+		}
+		else
+		{
+			std::vector<GLuint> rebased(indexCount);
+			for (GLsizei i = 0; i < indexCount; i++)
+				rebased[i] = sourceIndex(i) + base;
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, static_cast<GLintptr>(allocation.firstIndex) * sizeof(GLuint),
+				rebased.size() * sizeof(GLuint), rebased.data());
+		}
+		glState.bindVertexArray(0);
+
+		return allocation;
+	}
+
+	void release(const ArenaAllocation& allocation)
+	{
+		if (allocation.pool < 0 || allocation.pool >= static_cast<int>(pools.size()))
+			return;
+
+		Pool& pool = pools[allocation.pool];
+		pool.vertexRanges.release(allocation.firstVertex, allocation.vertexCount);
+		pool.indexRanges.release(allocation.firstIndex, allocation.indexCount);
+	}
+
+	GLuint vertexArray(int pool) const { return pools[pool].vao; }
+	GLuint vertexBuffer(int pool) const { return pools[pool].vbo; }
+	GLuint indexBuffer(int pool) const { return pools[pool].ibo; }
+	GLenum indexType(int pool) const { return pools[pool].indexType; }
+	size_t poolCount() const { return pools.size(); }
+
+	long long usedBytes() const
+	{
+		long long bytes = 0;
+		for (const Pool& pool : pools)
+		{
+			bytes += static_cast<long long>(pool.vertexRanges.used) * vertexStride(pool.format);
+			bytes += static_cast<long long>(pool.indexRanges.used) * indexSize(pool.indexType);
+		}
+		return bytes;
+	}
+
+	long long capacityBytes() const
+	{
+		long long bytes = 0;
+		for (const Pool& pool : pools)
+			bytes += pool.vbo.size() + pool.ibo.size();
+		return bytes;
+	}
+
+	void clear() { pools.clear(); }
+
+private:
+	struct Pool {
+		VertexFormat format;
+		GLenum indexType;
+		GLVertexArray vao;
+		GLBuffer vbo;
+		GLBuffer ibo;
+		RangeAllocator vertexRanges;
+		RangeAllocator indexRanges;
+	};
+	std::vector<Pool> pools;
+
+	static GLsizei indexSize(GLenum type) { return type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint); }
+
+	int createPool(VertexFormat format, GLenum indexType, GLsizei vertexCapacity, GLsizei indexCapacity)
+	{
+		Pool pool;
+		pool.format = format;
+		pool.indexType = indexType;
+		pool.vao = createGLVertexArray();
+		pool.vbo = createGLBuffer();
+		pool.ibo = createGLBuffer();
+		pool.vertexRanges = RangeAllocator(vertexCapacity);
+		pool.indexRanges = RangeAllocator(indexCapacity);
+
+		glState.bindVertexArray(pool.vao);
+		uploadBuffer(pool.vbo, GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(vertexCapacity) * vertexStride(format), nullptr, GL_STATIC_DRAW);
+		setVertexAttributes(format);
+		uploadBuffer(pool.ibo, GL_ELEMENT_ARRAY_BUFFER, static_cast<GLsizeiptr>(indexCapacity) * indexSize(indexType), nullptr, GL_STATIC_DRAW);
+		glState.bindVertexArray(0);
+
+		pools.push_back(std::move(pool));
+		return static_cast<int>(pools.size()) - 1;
+	}
+};
+
+inline GpuArena gpuArena;
+
+// Owns an allocation in gpuArena and gives it back when destroyed
+class ArenaHandle {
+public:
+	ArenaHandle() = default;
+	explicit ArenaHandle(const ArenaAllocation& a_allocation) : allocation(a_allocation) {}
+
+	ArenaHandle(const ArenaHandle&) = delete;
+	ArenaHandle& operator=(const ArenaHandle&) = delete;
+
+	ArenaHandle(ArenaHandle&& other) noexcept : allocation(other.allocation)
+	{
+		other.allocation = ArenaAllocation();
+	}
+
+	ArenaHandle& operator=(ArenaHandle&& other) noexcept
+	{
+		if (this != &other)
+		{
+			reset();
+			allocation = other.allocation;
+			other.allocation = ArenaAllocation();
+		}
+		return *this;
+	}
+
+	~ArenaHandle() { reset(); }
+
+	void reset()
+	{
+		gpuArena.release(allocation);
+		allocation = ArenaAllocation();
+	}
+
+	bool valid() const { return allocation.pool >= 0; }
+	const ArenaAllocation& get() const { return allocation; }
+
+private:
+	ArenaAllocation allocation;
+};
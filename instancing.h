@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "mat4.h"
+#include "stats.h"
+#include "gl_resource.h"
+#include "vertex.h"
+#include "memory_stats.h"
+
+// Per instance model matrices for glDrawElementsInstanced. Instances are culled against
+// the view frustum and the survivors packed to the front of one stream buffer, so a
+// whole crowd of one model costs a draw call per mesh whatever its size.
+// The transform goes to the mat4 attribute at locations 4 to 7 with divisor 1,
+// the shader uses it in place of the model uniform when instanced is set.
+
+const GLuint INSTANCE_ATTRIBUTE = 4;
+
+// Same 16 floats as the model uniform gets, in mat4::toFloatVector order
+struct InstanceTransform {
+	float m[16];
+};
+
+inline InstanceTransform instanceTransform(const mat4& model)
+{
+	InstanceTransform transform;
+	std::vector<float> values = model.toFloatVector();
+	for (int i = 0; i < 16; i++)
+		transform.m[i] = values[i];
+	return transform;
+}
+
+// Points the attributes of the bound vertex array at the transforms in buffer
+inline void setInstanceAttributes(GLuint buffer)
+{
+	glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (GLuint column = 0; column < 4; column++)
+	{
+		glEnableVertexAttribArray(INSTANCE_ATTRIBUTE + column);
+		glVertexAttribPointer(INSTANCE_ATTRIBUTE + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceTransform),
+			(void*)(column * 4 * sizeof(float)));
+		glVertexAttribDivisor(INSTANCE_ATTRIBUTE + column, 1);
+	}
+}
+
+// Clip planes of a view projection matrix, pointing inwards
+struct Frustum {
+	float planes[6][4];
+
+	// vp in mat4::toFloatVector order, rows of the matrix applied to column vectors
+	static Frustum fromViewProjection(const std::vector<float>& vp)
+	{
+		Frustum frustum;
+		for (int i = 0; i < 6; i++)
+		{
+			int row = i / 2;
+			float sign = i % 2 ? -1.0f : 1.0f;
+			float length = 0.0f;
+			for (int c = 0; c < 4; c++)
+			{
+				frustum.planes[i][c] = vp[12 + c] + sign * vp[4 * row + c];
+				if (c < 3)
+					length += frustum.planes[i][c] * frustum.planes[i][c];
+			}
+			length = std::sqrt(length);
+			for (int c = 0; c < 4 && length > 0.0f; c++)
+				frustum.planes[i][c] /= length;
+		}
+		return frustum;
+	}
+
+	// Local bounds moved by transform, tested as the world box around them
+	bool intersects(const InstanceTransform& transform, const float boundsMin[3], const float boundsMax[3]) const
+	{
+		const float* m = transform.m;
+		float center[3], extent[3];
+		for (int r = 0; r < 3; r++)
+		{
+			center[r] = m[4 * r + 3];
+			extent[r] = 0.0f;
+			for (int c = 0; c < 3; c++)
+			{
+				float localCenter = (boundsMin[c] + boundsMax[c]) * 0.5f;
+				float localExtent = (boundsMax[c] - boundsMin[c]) * 0.5f;
+				center[r] += m[4 * r + c] * localCenter;
+				extent[r] += std::fabs(m[4 * r + c]) * localExtent;
+			}
+		}
+
+		for (const float* plane : planes)
+		{
+			float distance = plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3];
+			float radius = std::fabs(plane[0]) * extent[0] + std::fabs(plane[1]) * extent[1] + std::fabs(plane[2]) * extent[2];
+			if (distance + radius < 0.0f)
+				return false;
+		}
+		return true;
+	}
+};
+
+// Framebuffer pixels covered by local bounds moved by transform, as x, y, width, height
+// clamped to the framebuffer. False when the bounds reach behind the camera, their
+// projection is unbounded then
+inline bool screenRect(const std::vector<float>& vp, const InstanceTransform& transform, const float boundsMin[3],
+	const float boundsMax[3], int width, int height, int rect[4])
+{
+	const float* m = transform.m;
+	float low[2] = { 1.0f, 1.0f };
+	float high[2] = { -1.0f, -1.0f };
+	for (int corner = 0; corner < 8; corner++)
+	{
+		float local[4] = { corner & 1 ? boundsMax[0] : boundsMin[0], corner & 2 ? boundsMax[1] : boundsMin[1],
+			corner & 4 ? boundsMax[2] : boundsMin[2], 1.0f };
+		float world[4];
+		for (int r = 0; r < 4; r++)
+			world[r] = m[4 * r] * local[0] + m[4 * r + 1] * local[1] + m[4 * r + 2] * local[2] + m[4 * r + 3];
+		float clip[4];
+		for (int r = 0; r < 4; r++)
+			clip[r] = vp[4 * r] * world[0] + vp[4 * r + 1] * world[1] + vp[4 * r + 2] * world[2] + vp[4 * r + 3] * world[3];
+		if (clip[3] <= 1e-4f)
+			return false;
+		for (int a = 0; a < 2; a++)
+		{
+			low[a] = std::min(low[a], clip[a] / clip[3]);
+			high[a] = std::max(high[a], clip[a] / clip[3]);
+		}
+	}
+
+	int size[2] = { width, height };
+	for (int a = 0; a < 2; a++)
+	{
+		int first = static_cast<int>(std::floor((std::max(low[a], -1.0f) * 0.5f + 0.5f) * size[a]));
+		int last = static_cast<int>(std::ceil((std::min(high[a], 1.0f) * 0.5f + 0.5f) * size[a]));
+		rect[a] = first;
+		rect[a + 2] = std::max(0, last - first);
+	}
+	return true;
+}
+
+// Stream buffer of the instances drawn this frame, plus the vertex arrays pairing it with
+// each vertex buffer it is drawn with
+class InstanceBuffer {
+public:
+	// Culls when frustum is given, returns the number of instances kept
+	GLsizei update(const std::vector<InstanceTransform>& transforms, const float boundsMin[3], const float boundsMax[3],
+		const Frustum* frustum)
+	{
+		visible.clear();
+		for (const InstanceTransform& transform : transforms)
+		{
+			if (!frustum || frustum->intersects(transform, boundsMin, boundsMax))
+				visible.push_back(transform);
+		}
+		frameStats.culledInstances += static_cast<unsigned int>(transforms.size() - visible.size());
+
+		createBuffer();
+		count = static_cast<GLsizei>(visible.size());
+		if (count == 0)
+			return 0;
+
+		// Orphans the last frame's storage rather than waiting on draws still reading it
+		if (count > capacity)
+			capacity = std::max(count, capacity * 2);
+		GLsizeiptr bytes = static_cast<GLsizeiptr>(capacity) * sizeof(InstanceTransform);
+		uploadBuffer(buffer, GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, static_cast<GLsizeiptr>(count) * sizeof(InstanceTransform), visible.data());
+		frameStats.glCalls += 2;
+		return count;
+	}
+
+	GLsizei size() const { return count; }
+
+	long long cpuBytes() const { return vectorBytes(visible) + vectorBytes(vertexArrays); }
+	long long gpuBytes() const { return buffer.size(); }
+
+	// Vertex array reading vbo and ibo in format, plus the instance transforms.
+	// source is the vertex array normally drawn with them, one is made per source
+	GLuint vertexArray(GLuint source, GLuint vbo, GLuint ibo, VertexFormat format)
+	{
+		for (const SourceArray& array : vertexArrays)
+		{
+			if (array.source == source)
+				return array.vao;
+		}
+
+		createBuffer();
+		SourceArray array;
+		array.source = source;
+		array.vao = createGLVertexArray();
+		glState.bindVertexArray(array.vao);
+		glState.bindBuffer(GL_ARRAY_BUFFER, vbo);
+		setVertexAttributes(format);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+		setInstanceAttributes(buffer);
+		glState.bindVertexArray(0);
+
+		vertexArrays.push_back(std::move(array));
+		return vertexArrays.back().vao;
+	}
+
+	// For when the meshes drawn with it are replaced, their GL names can come back for
+	// other buffers and must not find a vertex array built on the old ones
+	void clearVertexArrays() { vertexArrays.clear(); }
+
+private:
+	struct SourceArray {
+		GLuint source;
+		GLVertexArray vao;
+	};
+
+	GLBuffer buffer;
+	GLsizei capacity = 0;
+	GLsizei count = 0;
+	std::vector<InstanceTransform> visible;
+	std::vector<SourceArray> vertexArrays;
+
+	// Made on first use, models are often constructed before the GL context
+	void createBuffer()
+	{
+		if (!buffer.get())
+			buffer = createGLBuffer();
+	}
+};
+
+// Transforms fixed at setup, uploaded once to a static buffer and added to the vertex
+// array of the geometry they place. Scene pieces that are not a Mesh, like the floor
+// tiles, then draw every copy with one glDrawElementsInstanced and no per frame work
+class StaticInstances {
+public:
+	// vertexArray already holds the per vertex attributes and index buffer
+	void create(const std::vector<InstanceTransform>& transforms, GLuint vertexArray)
+	{
+		count = static_cast<GLsizei>(transforms.size());
+		buffer = createGLBuffer();
+		glState.bindVertexArray(vertexArray);
+		uploadBuffer(buffer, GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(transforms.size() * sizeof(InstanceTransform)),
+			transforms.data(), GL_STATIC_DRAW);
+		setInstanceAttributes(buffer);
+		glState.bindVertexArray(0);
+	}
+
+	// With the vertex array bound and the program's instanced uniform set
+	void draw(GLsizei indexCount, GLenum indexType) const
+	{
+		if (count == 0)
+			return;
+		glDrawElementsInstanced(GL_TRIANGLES, indexCount, indexType, 0, count);
+		frameStats.drawCalls++;
+		frameStats.instances += static_cast<unsigned int>(count);
+	}
+
+	GLsizei size() const { return count; }
+	long long gpuBytes() const { return buffer.size(); }
+
+private:
+	GLBuffer buffer;
+	GLsizei count = 0;
+};
@@ -0,0 +1,337 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+
+// KTX2 container for GPU compressed textures, written by tools/texture_compressor and
+// uploaded with glCompressedTexImage2D, no decode on the CPU.
+// Only unsupercompressed ETC2 and ASTC LDR formats are read. ETC2 is core in GLES3
+// but an extension in WebGL2 (WEBGL_compressed_texture_etc), like ASTC, so callers
+// check ktx2FormatSupported and keep the source image as fallback.
+
+#ifndef GL_COMPRESSED_RGBA_ASTC_4x4_KHR
+#define GL_COMPRESSED_RGBA_ASTC_4x4_KHR 0x93B0
+#endif
+#ifndef GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR
+#define GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR 0x93D0
+#endif
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+// VkFormat values used in the header
+const uint32_t VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK = 147;
+const uint32_t VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK = 148;
+const uint32_t VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK = 151;
+const uint32_t VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK = 152;
+// 4x4 up to 12x12, UNORM and SRGB alternate
+const uint32_t VK_FORMAT_ASTC_4x4_UNORM_BLOCK = 157;
+const uint32_t VK_FORMAT_ASTC_12x12_SRGB_BLOCK = 184;
+
+struct Ktx2Header {
+	uint32_t vkFormat;
+	uint32_t typeSize;
+	uint32_t pixelWidth;
+	uint32_t pixelHeight;
+	uint32_t pixelDepth;
+	uint32_t layerCount;
+	uint32_t faceCount;
+	uint32_t levelCount;
+	uint32_t supercompressionScheme;
+	uint32_t dfdByteOffset;
+	uint32_t dfdByteLength;
+	uint32_t kvdByteOffset;
+	uint32_t kvdByteLength;
+	// 64-bit in the file, split so the struct has no padding
+	uint32_t sgdByteOffset[2];
+	uint32_t sgdByteLength[2];
+};
+
+struct Ktx2Level {
+	uint64_t byteOffset;
+	uint64_t byteLength;
+	uint64_t uncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 68, "Ktx2Header follows the file identifier as is");
+static_assert(sizeof(Ktx2Level) == 24, "Ktx2Level is read as is");
+
+// GL internal format and block size of a VkFormat, false for anything not handled here
+inline bool ktx2FormatInfo(uint32_t vkFormat, GLenum& glFormat, int& blockWidth, int& blockHeight, int& blockBytes)
+{
+	switch (vkFormat)
+	{
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK: glFormat = GL_COMPRESSED_RGB8_ETC2; break;
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK: glFormat = GL_COMPRESSED_SRGB8_ETC2; break;
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK: glFormat = GL_COMPRESSED_RGBA8_ETC2_EAC; break;
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK: glFormat = GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC; break;
+	default:
+		if (vkFormat < VK_FORMAT_ASTC_4x4_UNORM_BLOCK || vkFormat > VK_FORMAT_ASTC_12x12_SRGB_BLOCK)
+			return false;
+
+		// Same block order in Vulkan and GL, 4x4 5x4 5x5 6x5 6x6 8x5 8x6 8x8 10x5 10x6 10x8 10x10 12x10 12x12
+		static const int blocks[14][2] = { {4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6}, {8, 8},
+			{10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12} };
+		uint32_t index = (vkFormat - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2;
+		bool srgb = (vkFormat - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) % 2 == 1;
+		glFormat = (srgb ? GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR : GL_COMPRESSED_RGBA_ASTC_4x4_KHR) + index;
+		blockWidth = blocks[index][0];
+		blockHeight = blocks[index][1];
+		blockBytes = 16;
+		return true;
+	}
+
+	blockWidth = 4;
+	blockHeight = 4;
+	blockBytes = glFormat == GL_COMPRESSED_RGB8_ETC2 || glFormat == GL_COMPRESSED_SRGB8_ETC2 ? 8 : 16;
+	return true;
+}
+
+// Compressed variant looked up next to an image, image.jpg -> image.ktx2
+inline std::string ktx2Path(const std::string& path)
+{
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return path + ".ktx2";
+	return path.substr(0, dot) + ".ktx2";
+}
+
+inline bool hasGLExtension(const char* name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+		// Emscripten lists WebGL extensions both bare and with a GL_ prefix
+		if (extension && (std::strcmp(extension, name) == 0 ||
+			(std::strncmp(extension, "GL_", 3) == 0 && std::strcmp(extension + 3, name) == 0)))
+			return true;
+	}
+	return false;
+}
+
+// Asked once per family, the answer cannot change for a context
+inline bool ktx2FormatSupported(GLenum glFormat)
+{
+	bool astc = glFormat >= GL_COMPRESSED_RGBA_ASTC_4x4_KHR && glFormat <= GL_COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR + 13;
+	if (astc)
+	{
+		static bool supported = hasGLExtension("KHR_texture_compression_astc_ldr") ||
+			hasGLExtension("WEBGL_compressed_texture_astc");
+		return supported;
+	}
+#ifdef __EMSCRIPTEN__
+	static bool etc2 = hasGLExtension("WEBGL_compressed_texture_etc");
+	return etc2;
+#else
+	return true;
+#endif
+}
+
+// Parsed view into the file bytes, which must outlive it
+struct Ktx2Image {
+	Ktx2Header header = {};
+	std::vector<Ktx2Level> levels;
+	GLenum glFormat = 0;
+	int blockWidth = 4;
+	int blockHeight = 4;
+	int blockBytes = 8;
+	// KTXorientation, "rd" is rows top down, "ru" rows bottom up like stb_image with flip
+	bool bottomUp = false;
+	const unsigned char* data = nullptr;
+
+	uint32_t width(uint32_t level) const { return std::max(1u, header.pixelWidth >> level); }
+	uint32_t height(uint32_t level) const { return std::max(1u, header.pixelHeight >> level); }
+	uint32_t faces() const { return header.faceCount; }
+
+	// One face of one level, faces are stored one after the other in each level
+	const unsigned char* faceData(uint32_t level, uint32_t face) const
+	{
+		return data + levels[level].byteOffset + face * faceBytes(level);
+	}
+
+	GLsizei faceBytes(uint32_t level) const
+	{
+		uint32_t blocksX = (width(level) + blockWidth - 1) / blockWidth;
+		uint32_t blocksY = (height(level) + blockHeight - 1) / blockHeight;
+		return static_cast<GLsizei>(blocksX * blocksY * blockBytes);
+	}
+};
+
+// False for anything that is not a 2D or cube map KTX2 of a handled format, or is truncated
+inline bool parseKtx2(const std::vector<unsigned char>& bytes, Ktx2Image& image)
+{
+	if (bytes.size() < sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) ||
+		std::memcmp(bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+		return false;
+
+	Ktx2Header& header = image.header;
+	std::memcpy(&header, bytes.data() + sizeof(KTX2_IDENTIFIER), sizeof(header));
+	if (header.supercompressionScheme != 0 || header.pixelDepth != 0 || header.layerCount > 1 ||
+		(header.faceCount != 1 && header.faceCount != 6) || header.pixelWidth == 0 || header.pixelHeight == 0)
+		return false;
+	if (!ktx2FormatInfo(header.vkFormat, image.glFormat, image.blockWidth, image.blockHeight, image.blockBytes))
+		return false;
+
+	uint32_t levelCount = std::max(1u, header.levelCount);
+	size_t indexOffset = sizeof(KTX2_IDENTIFIER) + sizeof(header);
+	if (levelCount > 32 || indexOffset + levelCount * sizeof(Ktx2Level) > bytes.size())
+		return false;
+	image.levels.resize(levelCount);
+	std::memcpy(image.levels.data(), bytes.data() + indexOffset, levelCount * sizeof(Ktx2Level));
+	image.data = bytes.data();
+
+	for (uint32_t level = 0; level < levelCount; level++)
+	{
+		const Ktx2Level& entry = image.levels[level];
+		if (entry.byteOffset + entry.byteLength > bytes.size() ||
+			entry.byteLength < static_cast<uint64_t>(image.faceBytes(level)) * header.faceCount)
+			return false;
+	}
+
+	// Key/value pairs, each a length, a null terminated key then the value, padded to 4
+	size_t kvd = header.kvdByteOffset;
+	size_t kvdEnd = kvd + header.kvdByteLength;
+	if (kvdEnd > bytes.size())
+		return false;
+	while (kvd + 4 <= kvdEnd)
+	{
+		uint32_t length;
+		std::memcpy(&length, bytes.data() + kvd, 4);
+		if (kvd + 4 + length > kvdEnd)
+			break;
+		const char* key = reinterpret_cast<const char*>(bytes.data() + kvd + 4);
+		size_t keyLength = strnlen(key, length);
+		if (keyLength < length && std::strcmp(key, "KTXorientation") == 0)
+			image.bottomUp = keyLength + 2 < length && key[keyLength + 2] == 'u';
+		kvd += (4 + length + 3) & ~size_t(3);
+	}
+	return true;
+}
+
+// Uploads every level, target is GL_TEXTURE_2D, or a cube map face for one face files.
+// Cube map files fill all six faces when target is GL_TEXTURE_CUBE_MAP
+inline void uploadKtx2(GLTexture& texture, GLenum target, const Ktx2Image& image)
+{
+	bool cube = target != GL_TEXTURE_2D;
+	glState.bindTexture(cube ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, texture);
+
+	long long bytes = 0;
+	for (uint32_t level = 0; level < image.levels.size(); level++)
+	{
+		for (uint32_t face = 0; face < image.faces(); face++)
+		{
+			GLenum faceTarget = target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+			glCompressedTexImage2D(faceTarget, static_cast<GLint>(level), image.glFormat, image.width(level),
+				image.height(level), 0, image.faceBytes(level), image.faceData(level, face));
+			bytes += image.faceBytes(level);
+		}
+	}
+	texture.setBytes(texture.size() + bytes);
+
+	if (!cube)
+	{
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(image.levels.size()) - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, image.levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+}
+
+// Level data for writeKtx2, faces of a level concatenated
+struct Ktx2LevelData {
+	std::vector<unsigned char> bytes;
+};
+
+// Data format descriptor of an ETC2 texture, required by the spec even though the
+// loader only looks at vkFormat
+inline std::vector<uint32_t> etc2Descriptor(bool alpha, bool srgb)
+{
+	const uint32_t KHR_DF_MODEL_ETC2 = 161;
+	const uint32_t KHR_DF_CHANNEL_ETC2_COLOR = 2;
+	const uint32_t KHR_DF_CHANNEL_ETC2_ALPHA = 15;
+	uint32_t samples = alpha ? 2 : 1;
+	uint32_t blockSize = 24 + 16 * samples;
+
+	std::vector<uint32_t> dfd;
+	dfd.push_back(4 + blockSize);
+	dfd.push_back(0); // vendor Khronos, basic descriptor
+	dfd.push_back(2 | (blockSize << 16)); // version 2
+	dfd.push_back(KHR_DF_MODEL_ETC2 | (1 << 8) | ((srgb ? 2u : 1u) << 16)); // BT709 primaries, transfer
+	dfd.push_back(3 | (3 << 8)); // 4x4 texel blocks
+	dfd.push_back(alpha ? 16 : 8); // bytes per block
+	dfd.push_back(0);
+
+	uint32_t bitOffset = 0;
+	if (alpha)
+	{
+		dfd.insert(dfd.end(), { bitOffset | (63u << 16) | (KHR_DF_CHANNEL_ETC2_ALPHA << 24), 0, 0, 0xffffffffu });
+		bitOffset += 64;
+	}
+	dfd.insert(dfd.end(), { bitOffset | (63u << 16) | (KHR_DF_CHANNEL_ETC2_COLOR << 24), 0, 0, 0xffffffffu });
+	return dfd;
+}
+
+// Writes levels largest first in the index, smallest first in the file as the spec advises
+inline bool writeKtx2(const std::string& path, uint32_t vkFormat, uint32_t width, uint32_t height, uint32_t faces,
+	const std::vector<Ktx2LevelData>& levels, const std::vector<uint32_t>& dfd, bool bottomUp)
+{
+	std::vector<unsigned char> kvd;
+	const char key[] = "KTXorientation";
+	const char* value = bottomUp ? "ru" : "rd";
+	uint32_t length = sizeof(key) + 3;
+	kvd.resize(4);
+	std::memcpy(kvd.data(), &length, 4);
+	kvd.insert(kvd.end(), key, key + sizeof(key));
+	kvd.insert(kvd.end(), value, value + 3);
+	kvd.resize((kvd.size() + 3) & ~size_t(3), 0);
+
+	Ktx2Header header = {};
+	header.vkFormat = vkFormat;
+	header.typeSize = 1;
+	header.pixelWidth = width;
+	header.pixelHeight = height;
+	header.faceCount = faces;
+	header.levelCount = static_cast<uint32_t>(levels.size());
+
+	size_t offset = sizeof(KTX2_IDENTIFIER) + sizeof(header) + levels.size() * sizeof(Ktx2Level);
+	header.dfdByteOffset = static_cast<uint32_t>(offset);
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+	offset += header.dfdByteLength;
+	header.kvdByteOffset = static_cast<uint32_t>(offset);
+	header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+	offset += kvd.size();
+
+	// Level data aligned on the block size, 16 covers every format written here
+	std::vector<Ktx2Level> index(levels.size());
+	for (size_t l = levels.size(); l-- > 0;)
+	{
+		offset = (offset + 15) & ~size_t(15);
+		index[l] = { offset, levels[l].bytes.size(), levels[l].bytes.size() };
+		offset += levels[l].bytes.size();
+	}
+
+	std::vector<unsigned char> file(offset, 0);
+	std::memcpy(file.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	std::memcpy(file.data() + sizeof(KTX2_IDENTIFIER), &header, sizeof(header));
+	std::memcpy(file.data() + sizeof(KTX2_IDENTIFIER) + sizeof(header), index.data(), index.size() * sizeof(Ktx2Level));
+	std::memcpy(file.data() + header.dfdByteOffset, dfd.data(), header.dfdByteLength);
+	std::memcpy(file.data() + header.kvdByteOffset, kvd.data(), kvd.size());
+	for (size_t l = 0; l < levels.size(); l++)
+		std::memcpy(file.data() + index[l].byteOffset, levels[l].bytes.data(), levels[l].bytes.size());
+
+	FILE* out = std::fopen(path.c_str(), "wb");
+	if (!out)
+		return false;
+	bool written = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+	return std::fclose(out) == 0 && written;
+}
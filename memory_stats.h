@@ -0,0 +1,198 @@
+#pragma once
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#endif
+
+// Memory held by each asset, gathered on demand into a MemoryReport by whoever owns the
+// assets (collectMemory in shell.cpp). CPU bytes are what an asset keeps on the heap,
+// GPU bytes the same estimates gpuResources adds up.
+// Subsystem totals are checked against MemoryBudgets, the wasm heap only ever grows
+// under ALLOW_MEMORY_GROWTH so a budget is the one way to keep it in check.
+
+struct AssetMemory {
+	std::string subsystem;
+	std::string name;
+	long long cpuBytes = 0;
+	long long gpuBytes = 0;
+	// Meshes, textures or faces the asset is made of
+	unsigned int count = 0;
+};
+
+// 0 leaves that side unlimited
+struct MemoryBudget {
+	std::string subsystem;
+	long long cpuBytes = 0;
+	long long gpuBytes = 0;
+};
+
+struct SubsystemMemory {
+	std::string name;
+	long long cpuBytes = 0;
+	long long gpuBytes = 0;
+	unsigned int count = 0;
+	unsigned int assets = 0;
+	const MemoryBudget* budget = nullptr;
+
+	bool overBudget() const
+	{
+		return budget && ((budget->cpuBytes && cpuBytes > budget->cpuBytes) ||
+			(budget->gpuBytes && gpuBytes > budget->gpuBytes));
+	}
+};
+
+template <typename T>
+inline long long vectorBytes(const std::vector<T>& values)
+{
+	return static_cast<long long>(values.capacity()) * sizeof(T);
+}
+
+// Current size of the wasm heap, 0 on native builds
+inline long long heapBytes()
+{
+#ifdef __EMSCRIPTEN__
+	return static_cast<long long>(emscripten_get_heap_size());
+#else
+	return 0;
+#endif
+}
+
+class MemoryReport {
+public:
+	std::vector<AssetMemory> assets;
+	std::vector<MemoryBudget> budgets;
+
+	void add(AssetMemory asset) { assets.push_back(std::move(asset)); }
+
+	// In the order subsystems were first added
+	std::vector<SubsystemMemory> subsystems() const
+	{
+		std::vector<SubsystemMemory> totals;
+		for (const AssetMemory& asset : assets)
+		{
+			SubsystemMemory* total = nullptr;
+			for (SubsystemMemory& existing : totals)
+			{
+				if (existing.name == asset.subsystem)
+					total = &existing;
+			}
+			if (!total)
+			{
+				totals.push_back(SubsystemMemory());
+				total = &totals.back();
+				total->name = asset.subsystem;
+				for (const MemoryBudget& budget : budgets)
+				{
+					if (budget.subsystem == asset.subsystem)
+						total->budget = &budget;
+				}
+			}
+			total->cpuBytes += asset.cpuBytes;
+			total->gpuBytes += asset.gpuBytes;
+			total->count += asset.count;
+			total->assets++;
+		}
+		return totals;
+	}
+
+	long long cpuBytes() const
+	{
+		long long total = 0;
+		for (const AssetMemory& asset : assets)
+			total += asset.cpuBytes;
+		return total;
+	}
+
+	long long gpuBytes() const
+	{
+		long long total = 0;
+		for (const AssetMemory& asset : assets)
+			total += asset.gpuBytes;
+		return total;
+	}
+
+	// Prints one line per subsystem over budget, true when none is
+	bool checkBudgets() const
+	{
+		bool withinBudget = true;
+		for (const SubsystemMemory& subsystem : subsystems())
+		{
+			if (!subsystem.overBudget())
+				continue;
+			withinBudget = false;
+			std::cout << "WARNING: " << subsystem.name << " over memory budget, CPU " << subsystem.cpuBytes / 1024
+				<< " / " << subsystem.budget->cpuBytes / 1024 << " KB, GPU " << subsystem.gpuBytes / 1024 << " / "
+				<< subsystem.budget->gpuBytes / 1024 << " KB" << std::endl;
+		}
+		return withinBudget;
+	}
+
+	std::string toJson() const
+	{
+		std::string json = "{\n  \"heapBytes\": " + std::to_string(heapBytes()) +
+			",\n  \"cpuBytes\": " + std::to_string(cpuBytes()) + ",\n  \"gpuBytes\": " + std::to_string(gpuBytes()) +
+			",\n  \"subsystems\": [";
+		std::vector<SubsystemMemory> totals = subsystems();
+		for (size_t i = 0; i < totals.size(); i++)
+		{
+			const SubsystemMemory& total = totals[i];
+			json += std::string(i ? "," : "") + "\n    { \"name\": " + quoted(total.name) +
+				", \"cpuBytes\": " + std::to_string(total.cpuBytes) + ", \"gpuBytes\": " + std::to_string(total.gpuBytes) +
+				", \"count\": " + std::to_string(total.count) + ", \"assets\": " + std::to_string(total.assets);
+			if (total.budget)
+			{
+				json += ", \"cpuBudget\": " + std::to_string(total.budget->cpuBytes) + ", \"gpuBudget\": " +
+					std::to_string(total.budget->gpuBytes) + ", \"overBudget\": " + (total.overBudget() ? "true" : "false");
+			}
+			json += " }";
+		}
+		json += "\n  ],\n  \"assets\": [";
+		for (size_t i = 0; i < assets.size(); i++)
+		{
+			const AssetMemory& asset = assets[i];
+			json += std::string(i ? "," : "") + "\n    { \"subsystem\": " + quoted(asset.subsystem) +
+				", \"name\": " + quoted(asset.name) + ", \"cpuBytes\": " + std::to_string(asset.cpuBytes) +
+				", \"gpuBytes\": " + std::to_string(asset.gpuBytes) + ", \"count\": " + std::to_string(asset.count) + " }";
+		}
+		json += "\n  ]\n}\n";
+		return json;
+	}
+
+	bool writeJson(const std::string& path) const
+	{
+		std::ofstream file(path);
+		file << toJson();
+		return static_cast<bool>(file);
+	}
+
+private:
+	static std::string quoted(const std::string& text)
+	{
+		std::string out = "\"";
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				out += '\\';
+				out += c;
+			}
+			else if (static_cast<unsigned char>(c) < 0x20)
+			{
+				char escaped[8];
+				std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out += escaped;
+			}
+			else
+			{
+				out += c;
+			}
+		}
+		return out + "\"";
+	}
+};
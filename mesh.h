@@ -2,16 +2,47 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <GLES3/gl3.h>
 
 #include "vec3.h"
 #include "vec2.h"
+#include "quantize.h"
+#include "stats.h"
+#include "gl_resource.h"
+#include "vertex.h"
+#include "gpu_arena.h"
+#include "instancing.h"
+#include "memory_stats.h"
+#include "render_queue.h"
 
-struct Vertex {
-	float Pos[3];
-	float Colors[3] = { 1.0, 1.0, 1.0 };
-	float TexUV[2];
-	float Normal[3];
+// Owned gives the mesh its own VAO and buffers, Arena sub-allocates from gpuArena
+enum class MeshStorage {
+	Owned,
+	Arena
+};
+
+// Sampler slot resolved once per (mesh, program), Draw only replays these
+struct SamplerBinding {
+	GLint unit;
+	GLint location;
+	GLuint texture;
+};
+
+// Vertices and indices already in their GPU layout, as stored by a baked model.
+// The pointers are only read during construction
+struct GpuMeshData {
+	VertexFormat format = VertexFormat::Float;
+	GLenum indexType = GL_UNSIGNED_INT;
+	const void* vertexData = nullptr;
+	GLsizei vertexCount = 0;
+	const void* indexData = nullptr;
+	GLsizei indexCount = 0;
+	float boundsMin[3] = { 0.0, 0.0, 0.0 };
+	float boundsMax[3] = { 0.0, 0.0, 0.0 };
+	float posScale[3] = { 1.0, 1.0, 1.0 };
+	float posOffset[3] = { 0.0, 0.0, 0.0 };
+	std::vector<MeshLod> lods;
 };
 
 struct Texture {
@@ -27,41 +58,255 @@ public:
 	
 	std::vector<Texture> textures;
 	std::vector<Texture> defaultTextures;
-	GLuint VAO;
+	GLVertexArray VAO;
+
+	VertexFormat format = VertexFormat::Float;
+	MeshStorage storage = MeshStorage::Owned;
+	// Picked at upload, GL_UNSIGNED_SHORT whenever every index fits
+	GLenum indexType = GL_UNSIGNED_INT;
+	GLsizeiptr vertexBytes = 0;
+	GLsizeiptr indexBytes = 0;
+	// Counts survive releaseCpuData, draw from these rather than the vectors
+	GLsizei vertexCount = 0;
+	GLsizei indexCount = 0;
+	float boundsMin[3] = { 0.0, 0.0, 0.0 };
+	float boundsMax[3] = { 0.0, 0.0, 0.0 };
+	// Level 0 is the full mesh, filled in at upload when no chain was given
+	std::vector<MeshLod> lods;
+	// Layer of the material in the texture arrays bound by the model, -1 binds textures one by one
+	GLint materialLayer = -1;
 
 	Mesh() = default;
 
-	Mesh(std::vector<Vertex> a_vertices, std::vector<GLuint> a_indices)
+	// Pass the vectors as rvalues to avoid any copy, they are moved into the mesh
+	Mesh(std::vector<Vertex> a_vertices, std::vector<GLuint> a_indices, VertexFormat a_format = VertexFormat::Float,
+		MeshStorage a_storage = MeshStorage::Owned)
+		: vertices(std::move(a_vertices)), indices(std::move(a_indices)), textures(defaultTextures), format(a_format),
+		storage(a_storage)
 	{
-		vertices = a_vertices;
-		indices = a_indices;
-		textures = defaultTextures;
-
 		SetMesh();
 	}
 
-	Mesh(std::vector<Vertex> a_vertices, std::vector<GLuint> a_indices, std::vector<Texture> a_textures) 
+	Mesh(std::vector<Vertex> a_vertices, std::vector<GLuint> a_indices, std::vector<Texture> a_textures,
+		VertexFormat a_format = VertexFormat::Float, std::vector<MeshLod> a_lods = std::vector<MeshLod>(),
+		MeshStorage a_storage = MeshStorage::Owned) 
+		: vertices(std::move(a_vertices)), indices(std::move(a_indices)), textures(std::move(a_textures)), format(a_format),
+		storage(a_storage), lods(std::move(a_lods))
 	{
-		vertices = a_vertices;
-		indices = a_indices;
-		textures = a_textures;
-
 		SetMesh();
 	}
 
+	// Uploads pre-packed data as is, no CPU copy is kept
+	Mesh(const GpuMeshData& data, std::vector<Texture> a_textures, MeshStorage a_storage = MeshStorage::Owned)
+		: textures(std::move(a_textures)), format(data.format), storage(a_storage), lods(data.lods)
+	{
+		vertexCount = data.vertexCount;
+		indexCount = data.indexCount;
+		if (lods.empty())
+			lods.push_back({ 0, indexCount, 0.0f });
+		for (int c = 0; c < 3; c++)
+		{
+			boundsMin[c] = data.boundsMin[c];
+			boundsMax[c] = data.boundsMax[c];
+			posScale[c] = data.posScale[c];
+			posOffset[c] = data.posOffset[c];
+		}
+		upload(data.vertexData, data.indexType, data.indexData);
+	}
+
+	// Owns its GL objects, so meshes can be moved but never copied
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&&) = default;
+	Mesh& operator=(Mesh&&) = default;
 	~Mesh() {}
+
+	// Drop the CPU copies once uploaded, only GPU handles, counts and bounds are kept
+	void releaseCpuData()
+	{
+		std::vector<Vertex>().swap(vertices);
+		std::vector<GLuint>().swap(indices);
+	}
+
+	bool hasCpuData() const { return !vertices.empty(); }
+
+	// Swaps in other textures, or a texture array layer with textures only naming its maps
+	void setMaterial(std::vector<Texture> a_textures, GLint layer = -1)
+	{
+		textures = std::move(a_textures);
+		materialLayer = layer;
+		programBindings.clear();
+	}
+
+	// Heap copies and level table, textures are counted by textureCache
+	long long cpuBytes() const
+	{
+		return vectorBytes(vertices) + vectorBytes(indices) + vectorBytes(lods) + vectorBytes(textures) +
+			vectorBytes(defaultTextures);
+	}
+
+	// Own buffers, or the share of the arena pool the mesh occupies
+	long long gpuBytes() const
+	{
+		return arena.valid() ? vertexBytes + indexBytes : VBO.size() + EBO.size();
+	}
+
+	// Coarsest level whose error stays under maxPixelError once projected,
+	// pixelsPerUnit is the size in pixels of one world unit at the mesh position
+	int selectLod(double pixelsPerUnit, double maxPixelError) const
+	{
+		double extent = std::max(boundsMax[0] - boundsMin[0], std::max(boundsMax[1] - boundsMin[1], boundsMax[2] - boundsMin[2]));
+		int chosen = 0;
+		for (size_t i = 1; i < lods.size(); i++)
+		{
+			if (lods[i].error * extent * pixelsPerUnit <= maxPixelError)
+				chosen = static_cast<int>(i);
+		}
+		return chosen;
+	}
 	
-	void Draw(GLuint programID)
+	// Vertex array the mesh draws from, its own or the one of its arena pool
+	GLuint vertexArray() const
+	{
+		return arena.valid() ? gpuArena.vertexArray(arena.get().pool) : VAO.get();
+	}
+
+	// Same vertex buffers plus the transforms of instances
+	GLuint instancedVertexArray(InstanceBuffer& instances)
+	{
+		if (!arena.valid())
+			return instances.vertexArray(VAO, VBO, EBO, format);
+		int pool = arena.get().pool;
+		return instances.vertexArray(gpuArena.vertexArray(pool), gpuArena.vertexBuffer(pool), gpuArena.indexBuffer(pool),
+			format);
+	}
+
+	// Sort key material, meshes in texture arrays all bind the same ones
+	GLuint materialId() const
+	{
+		return materialLayer >= 0 || textures.empty() ? 0 : textures[0].id;
+	}
+
+	void Draw(GLuint programID, int lod = 0)
+	{
+		glState.bindVertexArray(vertexArray());
+		DrawBound(programID, lod);
+	}
+
+	// Draw with vertexArray() already bound, as RenderQueue does
+	void DrawBound(GLuint programID, int lod = 0)
+	{
+		// Default constructed or moved from, nothing to draw
+		if (lods.empty())
+			return;
+		const ProgramBindings& bindings = bindMaterial(programID);
+
+		// draw mesh, arena meshes start further into the pool index buffer
+		const MeshLod& level = lods[std::min(lod, static_cast<int>(lods.size()) - 1)];
+		glDrawElements(GL_TRIANGLES, level.count, indexType, indexOffset(level));
+
+		unbindMaterial(bindings);
+		frameStats.drawCalls++;
+	}
+
+	// One draw of every instance in instances, set up by InstanceBuffer::update
+	void DrawInstanced(GLuint programID, InstanceBuffer& instances, int lod = 0)
+	{
+		if (instances.size() == 0)
+			return;
+		glState.bindVertexArray(instancedVertexArray(instances));
+		DrawInstancedBound(programID, instances, lod);
+	}
+
+	// DrawInstanced with instancedVertexArray(instances) already bound
+	void DrawInstancedBound(GLuint programID, InstanceBuffer& instances, int lod = 0)
+	{
+		if (instances.size() == 0 || lods.empty())
+			return;
+
+		const ProgramBindings& bindings = bindMaterial(programID);
+		glUniform1i(bindings.instancedLoc, 1);
+
+		const MeshLod& level = lods[std::min(lod, static_cast<int>(lods.size()) - 1)];
+		glDrawElementsInstanced(GL_TRIANGLES, level.count, indexType, indexOffset(level), instances.size());
+
+		glUniform1i(bindings.instancedLoc, 0);
+		unbindMaterial(bindings);
+		frameStats.glCalls += 2;
+		frameStats.drawCalls++;
+		frameStats.instances += static_cast<unsigned int>(instances.size());
+	}
+
+	// RenderQueue item drawing level lod, on top of item which gives pass, program and transform
+	DrawItem queueItem(DrawItem item, int lod = 0)
 	{
+		item.material = materialId();
+		item.vertexArray = vertexArray();
+		item.draw = [](const DrawItem& queued) { static_cast<Mesh*>(queued.object)->DrawBound(queued.program, queued.param); };
+		item.object = this;
+		item.param = lod;
+		return item;
+	}
+
+	// Same for every instance in instances, which must stay updated until the item is issued
+	DrawItem queueInstancedItem(DrawItem item, InstanceBuffer& instances, int lod = 0)
+	{
+		item.material = materialId();
+		item.vertexArray = instancedVertexArray(instances);
+		item.draw = [](const DrawItem& queued) {
+			static_cast<Mesh*>(queued.object)->DrawInstancedBound(queued.program, *static_cast<InstanceBuffer*>(queued.context),
+				queued.param);
+		};
+		item.object = this;
+		item.context = &instances;
+		item.param = lod;
+		return item;
+	}
+
+private:
+	GLBuffer VBO, EBO;
+	ArenaHandle arena;
+
+	// Everything Draw needs from a program, looked up by name only on first use
+	struct ProgramBindings {
+		GLuint program;
+		std::vector<SamplerBinding> samplers;
+		GLint quantizedLoc;
+		GLint posScaleLoc;
+		GLint posOffsetLoc;
+		GLint instancedLoc;
+		GLint layeredLoc;
+		GLint materialLayerLoc;
+		// Set only while drawing meshes that have those maps
+		GLint normalMappedLoc;
+		GLint heightMappedLoc;
+		bool normalMapped = false;
+		bool heightMapped = false;
+	};
+	std::vector<ProgramBindings> programBindings;
+	// Dequantization applied in the shader, pos = packed * posScale + posOffset
+	float posScale[3] = { 1.0, 1.0, 1.0 };
+	float posOffset[3] = { 0.0, 0.0, 0.0 };
+
+	const ProgramBindings& bindingsFor(GLuint programID)
+	{
+		for (const ProgramBindings& bindings : programBindings)
+		{
+			if (bindings.program == programID)
+				return bindings;
+		}
+
+		ProgramBindings bindings;
+		bindings.program = programID;
+
+		// we assume a convention for sampler names in the shaders, texture_diffuseN, texture_specularN...
 		unsigned int diffuseNum = 1;
 		unsigned int specularNum = 1;
 		unsigned int normalNum = 1;
 		unsigned int heightNum = 1;
-	
+
 		for (unsigned int i = 0; i < textures.size(); i++)
 		{
-			// Activate proper texture unit
-			glActiveTexture(GL_TEXTURE0 + i);
 			std::string number;
 			std::string name = textures[i].type;
 
@@ -70,65 +315,168 @@ public:
 			else if (name == "texture_specular")
 				number = std::to_string(specularNum++);
 			else if (name == "texture_normal")
+			{
 				number = std::to_string(normalNum++);
+				bindings.normalMapped = true;
+			}
 			else if (name == "texture_height")
+			{
 				number = std::to_string(heightNum++);
+				bindings.heightMapped = true;
+			}
+
+			// Layered materials sample the arrays the model binds
+			if (materialLayer >= 0)
+				continue;
 
-			// Set sampler to tex unit
-			glUniform1i(glGetUniformLocation(programID, (name + number).c_str()), i);
-			// Bind tex
-			glBindTexture(GL_TEXTURE_2D, textures[i].id);
+			SamplerBinding sampler;
+			sampler.unit = static_cast<GLint>(i);
+			sampler.location = glGetUniformLocation(programID, (name + number).c_str());
+			sampler.texture = textures[i].id;
+			bindings.samplers.push_back(sampler);
 		}
 
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+		bindings.quantizedLoc = glGetUniformLocation(programID, "quantized");
+		bindings.posScaleLoc = glGetUniformLocation(programID, "posScale");
+		bindings.posOffsetLoc = glGetUniformLocation(programID, "posOffset");
+		bindings.instancedLoc = glGetUniformLocation(programID, "instanced");
+		bindings.normalMappedLoc = glGetUniformLocation(programID, "normalMapped");
+		bindings.heightMappedLoc = glGetUniformLocation(programID, "heightMapped");
+		bindings.layeredLoc = glGetUniformLocation(programID, "layered");
+		bindings.materialLayerLoc = glGetUniformLocation(programID, "materialLayer");
+		frameStats.uniformLookups += static_cast<unsigned int>(bindings.samplers.size()) + 8;
+
+		programBindings.push_back(bindings);
+		return programBindings.back();
+	}
 
-		// Set everything back to default
-		glBindVertexArray(0);
-		glActiveTexture(GL_TEXTURE0);
+	// Textures and dequantization uniforms, shared by Draw and DrawInstanced
+	const ProgramBindings& bindMaterial(GLuint programID)
+	{
+		const ProgramBindings& bindings = bindingsFor(programID);
+
+		for (const SamplerBinding& sampler : bindings.samplers)
+		{
+			// Activate proper texture unit, set sampler to it and bind tex
+			glUniform1i(sampler.location, sampler.unit);
+			glState.bindTexture(GL_TEXTURE0 + sampler.unit, GL_TEXTURE_2D, sampler.texture);
+		}
+		frameStats.glCalls += static_cast<unsigned int>(bindings.samplers.size());
+		if (materialLayer >= 0)
+		{
+			glUniform1i(bindings.layeredLoc, 1);
+			glUniform1f(bindings.materialLayerLoc, static_cast<GLfloat>(materialLayer));
+			frameStats.glCalls += 2;
+		}
 
+		// Compact formats are decoded in the vertex shader
+		if (format != VertexFormat::Float)
+		{
+			glUniform1i(bindings.quantizedLoc, 1);
+			glUniform3fv(bindings.posScaleLoc, 1, posScale);
+			glUniform3fv(bindings.posOffsetLoc, 1, posOffset);
+			frameStats.glCalls += 3;
+		}
+		if (bindings.normalMapped)
+		{
+			glUniform1i(bindings.normalMappedLoc, 1);
+			frameStats.glCalls++;
+		}
+		if (bindings.heightMapped)
+		{
+			glUniform1i(bindings.heightMappedLoc, 1);
+			frameStats.glCalls++;
+		}
+		return bindings;
 	}
 
-private:
-	GLuint VBO, EBO;
+	// Set everything back to default, the program is shared with plain float geometry
+	void unbindMaterial(const ProgramBindings& bindings)
+	{
+		if (materialLayer >= 0)
+		{
+			glUniform1i(bindings.layeredLoc, 0);
+			frameStats.glCalls++;
+		}
+		if (format != VertexFormat::Float)
+		{
+			glUniform1i(bindings.quantizedLoc, 0);
+			frameStats.glCalls++;
+		}
+		if (bindings.normalMapped)
+		{
+			glUniform1i(bindings.normalMappedLoc, 0);
+			frameStats.glCalls++;
+		}
+		if (bindings.heightMapped)
+		{
+			glUniform1i(bindings.heightMappedLoc, 0);
+			frameStats.glCalls++;
+		}
+	}
 
+	// Byte offset of a level in the bound index buffer
+	const void* indexOffset(const MeshLod& level) const
+	{
+		size_t firstIndex = level.first + (arena.valid() ? arena.get().firstIndex : 0);
+		GLsizei indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		return (void*)(firstIndex * indexSize);
+	}
 
 	void SetMesh()
 	{
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
+		vertexCount = static_cast<GLsizei>(vertices.size());
+		indexCount = static_cast<GLsizei>(indices.size());
+		if (lods.empty())
+			lods.push_back({ 0, indexCount, 0.0f });
+		computeVertexBounds(vertices, boundsMin, boundsMax);
 
-		glBindVertexArray(VAO);
+		std::vector<PackedVertex> packed;
+		const void* vertexData = vertices.data();
+		if (format != VertexFormat::Float)
+		{
+			packed = packVertices(vertices, format, boundsMin, boundsMax, posScale, posOffset);
+			vertexData = packed.data();
+		}
 
+		if (vertices.size() <= 65536)
+		{
+			std::vector<GLushort> shortIndices(indices.begin(), indices.end());
+			upload(vertexData, GL_UNSIGNED_SHORT, shortIndices.data());
+		}
+		else
+		{
+			upload(vertexData, GL_UNSIGNED_INT, indices.data());
+		}
+	}
 
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+	// vertexData is in the layout of format, indexData holds indexCount indices of type a_indexType
+	void upload(const void* vertexData, GLenum a_indexType, const void* indexData)
+	{
+		vertexBytes = static_cast<GLsizeiptr>(vertexCount) * vertexStride(format);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+		if (storage == MeshStorage::Arena)
+		{
+			arena = ArenaHandle(gpuArena.allocate(format, vertexData, vertexCount, a_indexType, indexData, indexCount));
+			indexType = gpuArena.indexType(arena.get().pool);
+			indexBytes = static_cast<GLsizeiptr>(indexCount) * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+			return;
+		}
 
-		// Set Vertex attrib ptr
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+		VAO = createGLVertexArray();
+		VBO = createGLBuffer();
+		EBO = createGLBuffer();
 
-		// Set Color attrib
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Colors));
+		glState.bindVertexArray(VAO);
 
-		// Set TexUV ptr
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexUV));
+		uploadBuffer(VBO, GL_ARRAY_BUFFER, vertexBytes, vertexData, GL_STATIC_DRAW);
+		setVertexAttributes(format);
 
-		// Set normal ptr
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+		indexType = a_indexType;
+		indexBytes = static_cast<GLsizeiptr>(indexCount) * (indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+		uploadBuffer(EBO, GL_ELEMENT_ARRAY_BUFFER, indexBytes, indexData, GL_STATIC_DRAW);
 
 		// Unbind VAO
-		glBindVertexArray(0);
-
+		glState.bindVertexArray(0);
 	}
 };
-
-
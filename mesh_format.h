@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "vertex.h"
+#include "model_import.h"
+
+// Baked model file (.wmdl), written by tools/model_baker and loaded by Model without assimp.
+// Vertices and indices are stored exactly as uploaded, in the layout of the baked
+// VertexFormat and index type, so loading is one read and one buffer upload per mesh.
+// Little endian, every section starts on 8 bytes:
+// header | BakedMesh[meshCount] | BakedLod[lodCount] | BakedTexture[textureCount] | strings | data
+
+const uint32_t BAKED_MODEL_MAGIC = 0x4c444d57; // "WMDL"
+// Bump whenever a record or the vertex layout changes, older files are rejected
+const uint32_t BAKED_MODEL_VERSION = 2;
+
+struct BakedModelHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t meshCount;
+	uint32_t lodCount;
+	uint32_t textureCount;
+	uint32_t stringBytes;
+	uint32_t importedMeshes;
+	uint32_t reserved;
+	uint64_t dataOffset;
+	uint64_t dataBytes;
+};
+
+struct BakedMesh {
+	uint32_t format; // VertexFormat
+	uint32_t indexType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	uint32_t firstLod;
+	uint32_t lodCount;
+	uint32_t firstTexture;
+	uint32_t textureCount;
+	uint32_t materialIndex;
+	float boundsMin[3];
+	float boundsMax[3];
+	float posScale[3];
+	float posOffset[3];
+	uint32_t reserved;
+	// Relative to dataOffset
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+};
+
+struct BakedLod {
+	uint32_t first;
+	uint32_t count;
+	float error;
+};
+
+// Offsets into the string table, strings are null terminated
+struct BakedTexture {
+	uint32_t path;
+	uint32_t type;
+};
+
+static_assert(sizeof(BakedModelHeader) == 48, "BakedModelHeader layout is part of the file format");
+static_assert(sizeof(BakedMesh) == 104, "BakedMesh layout is part of the file format");
+static_assert(sizeof(BakedLod) == 12, "BakedLod layout is part of the file format");
+static_assert(sizeof(BakedTexture) == 8, "BakedTexture layout is part of the file format");
+static_assert(sizeof(Vertex) == 15 * sizeof(float), "Float vertices are baked as raw Vertex");
+
+inline size_t bakedAlign(size_t offset) { return (offset + 7) & ~size_t(7); }
+
+// Packs every mesh in format and writes the file, false when it could not be written
+inline bool writeBakedModel(const std::string& path, const ModelData& model, VertexFormat format)
+{
+	std::vector<BakedMesh> meshes;
+	std::vector<BakedLod> lods;
+	std::vector<BakedTexture> textures;
+	std::string strings;
+	std::vector<char> data;
+
+	auto addString = [&strings](const std::string& value) {
+		uint32_t offset = static_cast<uint32_t>(strings.size());
+		strings.append(value);
+		strings.push_back('\0');
+		return offset;
+	};
+	auto addData = [&data](const void* bytes, size_t size) {
+		uint64_t offset = data.size();
+		data.insert(data.end(), static_cast<const char*>(bytes), static_cast<const char*>(bytes) + size);
+		data.resize(bakedAlign(data.size()), 0);
+		return offset;
+	};
+
+	for (const MeshData& source : model.meshes)
+	{
+		BakedMesh mesh = {};
+		mesh.format = static_cast<uint32_t>(format);
+		mesh.vertexCount = static_cast<uint32_t>(source.vertices.size());
+		mesh.indexCount = static_cast<uint32_t>(source.indices.size());
+		mesh.materialIndex = source.materialIndex;
+
+		computeVertexBounds(source.vertices, mesh.boundsMin, mesh.boundsMax);
+		if (format == VertexFormat::Float)
+		{
+			for (int c = 0; c < 3; c++)
+			{
+				mesh.posScale[c] = 1.0f;
+				mesh.posOffset[c] = 0.0f;
+			}
+			mesh.vertexOffset = addData(source.vertices.data(), source.vertices.size() * sizeof(Vertex));
+		}
+		else
+		{
+			std::vector<PackedVertex> packed = packVertices(source.vertices, format, mesh.boundsMin, mesh.boundsMax,
+				mesh.posScale, mesh.posOffset);
+			mesh.vertexOffset = addData(packed.data(), packed.size() * sizeof(PackedVertex));
+		}
+
+		// Same rule as Mesh, 16-bit whenever every index fits
+		if (source.vertices.size() <= 65536)
+		{
+			std::vector<GLushort> shortIndices(source.indices.begin(), source.indices.end());
+			mesh.indexType = GL_UNSIGNED_SHORT;
+			mesh.indexOffset = addData(shortIndices.data(), shortIndices.size() * sizeof(GLushort));
+		}
+		else
+		{
+			mesh.indexType = GL_UNSIGNED_INT;
+			mesh.indexOffset = addData(source.indices.data(), source.indices.size() * sizeof(GLuint));
+		}
+
+		mesh.firstLod = static_cast<uint32_t>(lods.size());
+		for (const MeshLod& lod : source.lods)
+			lods.push_back({ static_cast<uint32_t>(lod.first), static_cast<uint32_t>(lod.count), lod.error });
+		mesh.lodCount = static_cast<uint32_t>(lods.size()) - mesh.firstLod;
+
+		mesh.firstTexture = static_cast<uint32_t>(textures.size());
+		for (const TextureRef& texture : source.textures)
+			textures.push_back({ addString(texture.path), addString(texture.type) });
+		mesh.textureCount = static_cast<uint32_t>(textures.size()) - mesh.firstTexture;
+
+		meshes.push_back(mesh);
+	}
+
+	BakedModelHeader header = {};
+	header.magic = BAKED_MODEL_MAGIC;
+	header.version = BAKED_MODEL_VERSION;
+	header.meshCount = static_cast<uint32_t>(meshes.size());
+	header.lodCount = static_cast<uint32_t>(lods.size());
+	header.textureCount = static_cast<uint32_t>(textures.size());
+	header.stringBytes = static_cast<uint32_t>(strings.size());
+	header.importedMeshes = static_cast<uint32_t>(model.importedMeshes);
+
+	std::vector<char> file;
+	auto addSection = [&file](const void* bytes, size_t size) {
+		file.insert(file.end(), static_cast<const char*>(bytes), static_cast<const char*>(bytes) + size);
+		file.resize(bakedAlign(file.size()), 0);
+	};
+	addSection(&header, sizeof(header));
+	addSection(meshes.data(), meshes.size() * sizeof(BakedMesh));
+	addSection(lods.data(), lods.size() * sizeof(BakedLod));
+	addSection(textures.data(), textures.size() * sizeof(BakedTexture));
+	addSection(strings.data(), strings.size());
+
+	header.dataOffset = file.size();
+	header.dataBytes = data.size();
+	std::memcpy(file.data(), &header, sizeof(header));
+	file.insert(file.end(), data.begin(), data.end());
+
+	FILE* out = std::fopen(path.c_str(), "wb");
+	if (!out)
+		return false;
+	bool written = std::fwrite(file.data(), 1, file.size(), out) == file.size();
+	return std::fclose(out) == 0 && written;
+}
+
+// A baked model read into memory, records are validated on load and the vertex and
+// index data are handed to GL straight from the file buffer
+class BakedModel {
+public:
+	BakedModelHeader header = {};
+	std::vector<BakedMesh> meshes;
+	std::vector<BakedLod> lods;
+	std::vector<BakedTexture> textures;
+
+	// False when the file is missing, truncated, of another version or inconsistent
+	bool load(const std::string& path)
+	{
+		FILE* in = std::fopen(path.c_str(), "rb");
+		if (!in)
+			return false;
+		long size = std::fseek(in, 0, SEEK_END) == 0 ? std::ftell(in) : -1;
+		if (size < static_cast<long>(sizeof(BakedModelHeader)) || std::fseek(in, 0, SEEK_SET) != 0)
+		{
+			std::fclose(in);
+			return false;
+		}
+		bytes.resize(static_cast<size_t>(size));
+		bool read = std::fread(bytes.data(), 1, bytes.size(), in) == bytes.size();
+		std::fclose(in);
+
+		return read && parse();
+	}
+
+	const void* vertexData(const BakedMesh& mesh) const { return bytes.data() + header.dataOffset + mesh.vertexOffset; }
+	const void* indexData(const BakedMesh& mesh) const { return bytes.data() + header.dataOffset + mesh.indexOffset; }
+	const char* string(uint32_t offset) const { return bytes.data() + stringOffset + offset; }
+
+	// Drop the file contents once every mesh is uploaded
+	void releaseData() { std::vector<char>().swap(bytes); }
+
+private:
+	std::vector<char> bytes;
+	size_t stringOffset = 0;
+
+	template <typename T>
+	bool readSection(size_t& offset, std::vector<T>& out, uint32_t count)
+	{
+		size_t size = static_cast<size_t>(count) * sizeof(T);
+		if (offset + size > bytes.size())
+			return false;
+		out.resize(count);
+		if (size)
+			std::memcpy(out.data(), bytes.data() + offset, size);
+		offset = bakedAlign(offset + size);
+		return true;
+	}
+
+	bool indicesInRange(const BakedMesh& mesh) const
+	{
+		const char* data = static_cast<const char*>(indexData(mesh));
+		for (uint32_t i = 0; i < mesh.indexCount; i++)
+		{
+			uint32_t index;
+			if (mesh.indexType == GL_UNSIGNED_SHORT)
+			{
+				GLushort value;
+				std::memcpy(&value, data + i * sizeof(GLushort), sizeof(value));
+				index = value;
+			}
+			else
+			{
+				std::memcpy(&index, data + i * sizeof(GLuint), sizeof(index));
+			}
+			if (index >= mesh.vertexCount)
+				return false;
+		}
+		return true;
+	}
+
+	bool parse()
+	{
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		if (header.magic != BAKED_MODEL_MAGIC || header.version != BAKED_MODEL_VERSION)
+			return false;
+
+		size_t offset = bakedAlign(sizeof(header));
+		if (!readSection(offset, meshes, header.meshCount) || !readSection(offset, lods, header.lodCount) ||
+			!readSection(offset, textures, header.textureCount))
+			return false;
+
+		stringOffset = offset;
+		if (stringOffset + header.stringBytes > bytes.size() || (header.stringBytes && bytes[stringOffset + header.stringBytes - 1] != '\0'))
+			return false;
+		if (header.dataOffset < stringOffset + header.stringBytes || header.dataOffset > bytes.size() ||
+			header.dataBytes > bytes.size() - header.dataOffset)
+			return false;
+
+		for (const BakedMesh& mesh : meshes)
+		{
+			if (mesh.format > static_cast<uint32_t>(VertexFormat::Snorm16))
+				return false;
+			if (mesh.indexType != GL_UNSIGNED_SHORT && mesh.indexType != GL_UNSIGNED_INT)
+				return false;
+
+			uint64_t vertexBytes = static_cast<uint64_t>(mesh.vertexCount) * vertexStride(static_cast<VertexFormat>(mesh.format));
+			uint64_t indexBytes = static_cast<uint64_t>(mesh.indexCount) * (mesh.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+			if (mesh.vertexOffset > header.dataBytes || vertexBytes > header.dataBytes - mesh.vertexOffset ||
+				mesh.indexOffset > header.dataBytes || indexBytes > header.dataBytes - mesh.indexOffset)
+				return false;
+			// An index past the vertices would have the GPU read outside the vertex buffer
+			if (!indicesInRange(mesh))
+				return false;
+
+			if (static_cast<uint64_t>(mesh.firstLod) + mesh.lodCount > lods.size() ||
+				static_cast<uint64_t>(mesh.firstTexture) + mesh.textureCount > textures.size())
+				return false;
+			for (uint32_t l = mesh.firstLod; l < mesh.firstLod + mesh.lodCount; l++)
+			{
+				if (static_cast<uint64_t>(lods[l].first) + lods[l].count > mesh.indexCount)
+					return false;
+			}
+		}
+
+		for (const BakedTexture& texture : textures)
+		{
+			if (texture.path >= header.stringBytes || texture.type >= header.stringBytes)
+				return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <GLES3/gl3.h>
+
+#include "vertex.h"
+
+// Triangle and vertex reordering for indexed triangle lists, plain CPU code so it
+// can run at load time or ahead of time when baking assets.
+// Vertex cache order follows Tipsify (Sander, Nehab, Barczak 2007), the overdraw
+// pass sorts cache friendly clusters by how much they face outwards.
+
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+	float acmr = 0.0; // vertices transformed per triangle, 0.5 is the optimum for a grid
+	float atvr = 0.0; // vertices transformed per vertex, 1.0 is the optimum
+};
+
+struct MeshOptimizerReport {
+	VertexCacheStats before;
+	VertexCacheStats after;
+	unsigned int triangles = 0;
+	unsigned int vertices = 0;
+
+	void add(const MeshOptimizerReport& other)
+	{
+		// Weight ratios by the amount of geometry they describe
+		float t = static_cast<float>(triangles + other.triangles);
+		float v = static_cast<float>(vertices + other.vertices);
+		if (t > 0)
+		{
+			before.acmr = (before.acmr * triangles + other.before.acmr * other.triangles) / t;
+			after.acmr = (after.acmr * triangles + other.after.acmr * other.triangles) / t;
+		}
+		if (v > 0)
+		{
+			before.atvr = (before.atvr * vertices + other.before.atvr * other.vertices) / v;
+			after.atvr = (after.atvr * vertices + other.after.atvr * other.vertices) / v;
+		}
+		triangles += other.triangles;
+		vertices += other.vertices;
+	}
+
+	void print(const std::string& name) const
+	{
+		std::cout << name << ": " << triangles << " tris, " << vertices << " verts, ACMR "
+			<< before.acmr << " -> " << after.acmr << ", ATVR "
+			<< before.atvr << " -> " << after.atvr << std::endl;
+	}
+};
+
+// FIFO cache simulation, returns the number of misses for the triangle
+inline unsigned int simulateCacheTriangle(const GLuint* tri, std::vector<unsigned int>& timestamps,
+	unsigned int& time, unsigned int cacheSize)
+{
+	unsigned int misses = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		GLuint v = tri[k];
+		if (time - timestamps[v] > cacheSize)
+		{
+			timestamps[v] = time++;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+inline VertexCacheStats analyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount,
+	unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+	VertexCacheStats stats;
+	if (indices.size() < 3 || vertexCount == 0)
+		return stats;
+
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	unsigned int time = cacheSize + 1;
+	unsigned int misses = 0;
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		misses += simulateCacheTriangle(&indices[i], timestamps, time, cacheSize);
+
+	stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / vertexCount;
+	return stats;
+}
+
+// Tipsify, fans around the most recently used vertex that will still be in cache
+inline std::vector<GLuint> optimizeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount,
+	unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || vertexCount == 0)
+		return indices;
+
+	// Vertex to triangle adjacency stored as offsets into a flat list
+	std::vector<unsigned int> liveTriangles(vertexCount, 0);
+	for (GLuint index : indices)
+		liveTriangles[index]++;
+
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] = offsets[v] + liveTriangles[v];
+
+	std::vector<unsigned int> adjacency(indices.size());
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (int k = 0; k < 3; k++)
+			adjacency[fill[indices[3 * t + k]]++] = static_cast<unsigned int>(t);
+	}
+
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<GLuint> deadEnd;
+	std::vector<GLuint> candidates;
+	std::vector<GLuint> result;
+	result.reserve(indices.size());
+
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	long fanning = indices[0];
+
+	while (fanning >= 0)
+	{
+		candidates.clear();
+
+		for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++)
+		{
+			unsigned int t = adjacency[a];
+			if (emitted[t])
+				continue;
+
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint v = indices[3 * t + k];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTriangles[v]--;
+				if (time - timestamps[v] > cacheSize)
+					timestamps[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Prefer a candidate that stays in cache for all of its remaining triangles
+		long best = -1;
+		int bestPriority = -1;
+		for (GLuint v : candidates)
+		{
+			if (liveTriangles[v] == 0)
+				continue;
+
+			int priority = 0;
+			if (time - timestamps[v] + 2 * liveTriangles[v] <= cacheSize)
+				priority = static_cast<int>(time - timestamps[v]);
+			if (priority > bestPriority)
+			{
+				best = v;
+				bestPriority = priority;
+			}
+		}
+
+		// Dead end, go back through recently used vertices then scan forward
+		while (best == -1 && !deadEnd.empty())
+		{
+			GLuint v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0)
+				best = v;
+		}
+		while (best == -1 && cursor < vertexCount)
+		{
+			if (liveTriangles[cursor] > 0)
+				best = static_cast<long>(cursor);
+			cursor++;
+		}
+
+		fanning = best;
+	}
+
+	return result;
+}
+
+// Splits the cache optimized order into clusters and draws the most outward facing first,
+// threshold bounds how much ACMR can be traded for fewer overdrawn pixels
+inline std::vector<GLuint> optimizeOverdraw(const std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+	float threshold = 1.05f, unsigned int cacheSize = VERTEX_CACHE_SIZE)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount < 2 || vertices.empty())
+		return indices;
+
+	std::vector<unsigned int> timestamps(vertices.size(), 0);
+	unsigned int time = cacheSize + 1;
+
+	// Hard boundaries where the cache was effectively flushed
+	std::vector<size_t> hard;
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		if (simulateCacheTriangle(&indices[3 * t], timestamps, time, cacheSize) == 3)
+			hard.push_back(t);
+	}
+	if (hard.empty() || hard[0] != 0)
+		hard.insert(hard.begin(), 0);
+	hard.push_back(triangleCount);
+
+	// Soft boundaries inside each hard cluster once the local ACMR is good enough
+	std::vector<size_t> clusters;
+	for (size_t h = 0; h + 1 < hard.size(); h++)
+	{
+		size_t start = hard[h];
+		size_t end = hard[h + 1];
+
+		std::fill(timestamps.begin(), timestamps.end(), 0);
+		time = cacheSize + 1;
+		unsigned int clusterMisses = 0;
+		for (size_t t = start; t < end; t++)
+			clusterMisses += simulateCacheTriangle(&indices[3 * t], timestamps, time, cacheSize);
+
+		float clusterThreshold = threshold * clusterMisses / (end - start);
+
+		std::fill(timestamps.begin(), timestamps.end(), 0);
+		time = cacheSize + 1;
+		unsigned int runningMisses = 0;
+		size_t runningSize = 0;
+
+		clusters.push_back(start);
+		for (size_t t = start; t < end; t++)
+		{
+			runningMisses += simulateCacheTriangle(&indices[3 * t], timestamps, time, cacheSize);
+			runningSize++;
+
+			if (t + 1 < end && runningMisses <= clusterThreshold * runningSize)
+			{
+				clusters.push_back(t + 1);
+				std::fill(timestamps.begin(), timestamps.end(), 0);
+				time = cacheSize + 1;
+				runningMisses = 0;
+				runningSize = 0;
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	// Mesh centroid, area weighted
+	float meshCentroid[3] = { 0.0, 0.0, 0.0 };
+	float meshArea = 0.0;
+	std::vector<float> areas(triangleCount);
+	std::vector<float> normals(triangleCount * 3);
+	std::vector<float> centroids(triangleCount * 3);
+
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		const float* p0 = vertices[indices[3 * t]].Pos;
+		const float* p1 = vertices[indices[3 * t + 1]].Pos;
+		const float* p2 = vertices[indices[3 * t + 2]].Pos;
+
+		float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		float area = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+		for (int c = 0; c < 3; c++)
+		{
+			normals[3 * t + c] = n[c];
+			centroids[3 * t + c] = (p0[c] + p1[c] + p2[c]) / 3.0f;
+			meshCentroid[c] += centroids[3 * t + c] * area;
+		}
+		areas[t] = area;
+		meshArea += area;
+	}
+	if (meshArea > 0.0f)
+	{
+		for (int c = 0; c < 3; c++)
+			meshCentroid[c] /= meshArea;
+	}
+
+	struct Cluster {
+		size_t start;
+		size_t end;
+		float sortKey;
+	};
+	std::vector<Cluster> sorted;
+
+	for (size_t c = 0; c + 1 < clusters.size(); c++)
+	{
+		float centroid[3] = { 0.0, 0.0, 0.0 };
+		float normal[3] = { 0.0, 0.0, 0.0 };
+		float area = 0.0;
+
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				centroid[k] += centroids[3 * t + k] * areas[t];
+				normal[k] += normals[3 * t + k];
+			}
+			area += areas[t];
+		}
+
+		float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float key = 0.0;
+		if (area > 0.0f && length > 0.0f)
+		{
+			for (int k = 0; k < 3; k++)
+				key += (centroid[k] / area - meshCentroid[k]) * (normal[k] / length);
+		}
+
+		sorted.push_back({ clusters[c], clusters[c + 1], key });
+	}
+
+	std::stable_sort(sorted.begin(), sorted.end(),
+		[](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<GLuint> result;
+	result.reserve(indices.size());
+	for (const Cluster& cluster : sorted)
+		result.insert(result.end(), indices.begin() + 3 * cluster.start, indices.begin() + 3 * cluster.end);
+
+	return result;
+}
+
+// Reorders vertices by first use in the index buffer and remaps the indices,
+// vertices not referenced by any triangle are kept at the end
+inline void optimizeVertexFetch(std::vector<GLuint>& indices, std::vector<Vertex>& vertices)
+{
+	const GLuint unused = ~0u;
+	std::vector<GLuint> remap(vertices.size(), unused);
+	GLuint next = 0;
+
+	for (GLuint& index : indices)
+	{
+		if (remap[index] == unused)
+			remap[index] = next++;
+		index = remap[index];
+	}
+	for (GLuint& target : remap)
+	{
+		if (target == unused)
+			target = next++;
+	}
+
+	std::vector<Vertex> reordered(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v++)
+		reordered[remap[v]] = vertices[v];
+	vertices.swap(reordered);
+}
+
+// Full pass, triangle order for the post transform cache then overdraw, then vertex order.
+// Vertex order can be kept when other data is indexed by vertex position, as for terrain grids
+inline MeshOptimizerReport optimizeMesh(std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+	bool reorderVertices = true)
+{
+	MeshOptimizerReport report;
+	report.triangles = static_cast<unsigned int>(indices.size() / 3);
+	report.vertices = static_cast<unsigned int>(vertices.size());
+	report.before = analyzeVertexCache(indices, vertices.size());
+
+	indices = optimizeVertexCache(indices, vertices.size());
+	indices = optimizeOverdraw(indices, vertices);
+	if (reorderVertices)
+		optimizeVertexFetch(indices, vertices);
+
+	report.after = analyzeVertexCache(indices, vertices.size());
+	return report;
+}
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// 2x2 box filtered mip chains for 8 bit images, shared by the texture loader, which runs
+// it on the worker threads, and tools/texture_compressor at bake time.
+// Linear images take a vertical pass summing row pairs to 16 bit and a horizontal pass
+// averaging neighbours, both SIMD (wasm simd128 with -msimd128, SSE2 natively) for even
+// sizes. Odd sizes clamp their last row or column on the scalar path.
+// sRGB images average their color channels in linear space through lookup tables, so
+// dark and bright texels keep their weight and distant surfaces do not darken. With 3 or 4
+// channels the table values of a pixel are gathered into float lanes and summed, scaled
+// and converted with SIMD, the table lookups themselves stay scalar.
+
+// One level below the source image, tightly packed like stb_image output
+struct MipLevel {
+	int width = 0;
+	int height = 0;
+	std::vector<unsigned char> pixels;
+};
+
+namespace mip_detail {
+
+struct SrgbTables {
+	float toLinear[256];
+	// Linear value in 1/4095 steps back to sRGB
+	unsigned char fromLinear[4096];
+
+	SrgbTables()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; i++)
+		{
+			float l = i / 4095.0f;
+			float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+			fromLinear[i] = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+		}
+	}
+};
+
+inline const SrgbTables& srgbTables()
+{
+	static const SrgbTables tables;
+	return tables;
+}
+
+// sums[i] = a[i] + b[i] over count bytes
+inline void sumRows(const unsigned char* a, const unsigned char* b, uint16_t* sums, size_t count)
+{
+	size_t i = 0;
+#if defined(__wasm_simd128__)
+	for (; i + 16 <= count; i += 16)
+	{
+		v128_t va = wasm_v128_load(a + i), vb = wasm_v128_load(b + i);
+		wasm_v128_store(sums + i, wasm_i16x8_add(wasm_u16x8_extend_low_u8x16(va), wasm_u16x8_extend_low_u8x16(vb)));
+		wasm_v128_store(sums + i + 8, wasm_i16x8_add(wasm_u16x8_extend_high_u8x16(va), wasm_u16x8_extend_high_u8x16(vb)));
+	}
+#elif defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		__m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i),
+			_mm_add_epi16(_mm_unpacklo_epi8(va, zero), _mm_unpacklo_epi8(vb, zero)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(sums + i + 8),
+			_mm_add_epi16(_mm_unpackhi_epi8(va, zero), _mm_unpackhi_epi8(vb, zero)));
+	}
+#endif
+	for (; i < count; i++)
+		sums[i] = static_cast<uint16_t>(a[i] + b[i]);
+}
+
+// out pixel x = (sums of pixels 2x and 2x + 1 + 2) / 4, per channel
+inline void averagePairs(const uint16_t* sums, unsigned char* out, int width, int components)
+{
+	int x = 0;
+	if (components == 4)
+	{
+		// Two output pixels from four input ones per step
+#if defined(__wasm_simd128__)
+		for (; x + 2 <= width; x += 2)
+		{
+			v128_t a = wasm_v128_load(sums + x * 8), b = wasm_v128_load(sums + x * 8 + 8);
+			v128_t sum = wasm_i16x8_add(wasm_i16x8_shuffle(a, b, 0, 1, 2, 3, 8, 9, 10, 11),
+				wasm_i16x8_shuffle(a, b, 4, 5, 6, 7, 12, 13, 14, 15));
+			sum = wasm_u16x8_shr(wasm_i16x8_add(sum, wasm_i16x8_splat(2)), 2);
+			wasm_v128_store64_lane(out + x * 4, wasm_u8x16_narrow_i16x8(sum, sum), 0);
+		}
+#elif defined(__SSE2__)
+		for (; x + 2 <= width; x += 2)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + x * 8));
+			__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sums + x * 8 + 8));
+			__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, sum));
+		}
+#endif
+	}
+	for (; x < width; x++)
+	{
+		for (int k = 0; k < components; k++)
+		{
+			int sum = sums[2 * x * components + k] + sums[(2 * x + 1) * components + k];
+			out[x * components + k] = static_cast<unsigned char>((sum + 2) / 4);
+		}
+	}
+}
+
+// Output pixels of one row of an sRGB image with 3 or 4 channels and width > 1, from
+// source rows row0 and row1. Alpha is averaged like the scalar path, rounded to nearest.
+// Returns how many pixels it wrote, the caller does the rest
+inline int averageSrgbPixels(const unsigned char* row0, const unsigned char* row1, unsigned char* out, int width,
+	int components, const SrgbTables& tables)
+{
+	int x = 0;
+#if defined(__wasm_simd128__) || defined(__SSE2__)
+	const float* toLinear = tables.toLinear;
+	bool alpha = components == 4;
+	// Color lanes become table indices, alpha rounds on its own scale
+	const float indexScale[4] = { 4095.0f, 4095.0f, 4095.0f, 1.0f };
+	int32_t indices[4];
+	for (; x < width; x++)
+	{
+		const unsigned char* p[4] = { row0 + 2 * x * components, row0 + (2 * x + 1) * components,
+			row1 + 2 * x * components, row1 + (2 * x + 1) * components };
+#if defined(__wasm_simd128__)
+		v128_t sum = wasm_f32x4_splat(0.0f);
+		for (const unsigned char* texel : p)
+		{
+			sum = wasm_f32x4_add(sum, wasm_f32x4_make(toLinear[texel[0]], toLinear[texel[1]], toLinear[texel[2]],
+				alpha ? static_cast<float>(texel[3]) : 0.0f));
+		}
+		sum = wasm_f32x4_mul(wasm_f32x4_mul(sum, wasm_f32x4_splat(0.25f)), wasm_v128_load(indexScale));
+		wasm_v128_store(indices, wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_add(sum, wasm_f32x4_splat(0.5f))));
+#else
+		__m128 sum = _mm_setzero_ps();
+		for (const unsigned char* texel : p)
+		{
+			sum = _mm_add_ps(sum, _mm_setr_ps(toLinear[texel[0]], toLinear[texel[1]], toLinear[texel[2]],
+				alpha ? static_cast<float>(texel[3]) : 0.0f));
+		}
+		sum = _mm_mul_ps(_mm_mul_ps(sum, _mm_set1_ps(0.25f)), _mm_loadu_ps(indexScale));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(indices), _mm_cvttps_epi32(_mm_add_ps(sum, _mm_set1_ps(0.5f))));
+#endif
+		unsigned char* pixel = out + x * components;
+		for (int k = 0; k < 3; k++)
+			pixel[k] = tables.fromLinear[indices[k]];
+		if (alpha)
+			pixel[3] = static_cast<unsigned char>(indices[3]);
+	}
+#else
+	(void)row0;
+	(void)row1;
+	(void)out;
+	(void)width;
+	(void)components;
+	(void)tables;
+#endif
+	return x;
+}
+
+} // namespace mip_detail
+
+// Next level of a width x height image, odd sizes clamp their last row or column.
+// With srgb the first three channels are filtered in linear space, alpha never is
+inline MipLevel downsampleLevel(const unsigned char* source, int width, int height, int components, bool srgb)
+{
+	MipLevel level;
+	level.width = std::max(1, width / 2);
+	level.height = std::max(1, height / 2);
+	level.pixels.resize(static_cast<size_t>(level.width) * level.height * components);
+	int colorChannels = srgb ? std::min(components, 3) : 0;
+	size_t rowBytes = static_cast<size_t>(width) * components;
+	size_t levelRowBytes = static_cast<size_t>(level.width) * components;
+
+	if (colorChannels == 0 && width % 2 == 0 && height % 2 == 0)
+	{
+		std::vector<uint16_t> sums(rowBytes);
+		for (int y = 0; y < level.height; y++)
+		{
+			mip_detail::sumRows(source + 2 * y * rowBytes, source + (2 * y + 1) * rowBytes, sums.data(), rowBytes);
+			mip_detail::averagePairs(sums.data(), level.pixels.data() + y * levelRowBytes, level.width, components);
+		}
+		return level;
+	}
+
+	const mip_detail::SrgbTables& tables = mip_detail::srgbTables();
+	for (int y = 0; y < level.height; y++)
+	{
+		const unsigned char* row0 = source + std::min(2 * y, height - 1) * rowBytes;
+		const unsigned char* row1 = source + std::min(2 * y + 1, height - 1) * rowBytes;
+		int x = 0;
+		// Every output pixel has two source columns once width > 1, rows are clamped above
+		if (colorChannels == 3 && width > 1)
+		{
+			x = mip_detail::averageSrgbPixels(row0, row1, level.pixels.data() + y * levelRowBytes, level.width,
+				components, tables);
+		}
+		for (; x < level.width; x++)
+		{
+			size_t x0 = static_cast<size_t>(std::min(2 * x, width - 1)) * components;
+			size_t x1 = static_cast<size_t>(std::min(2 * x + 1, width - 1)) * components;
+			unsigned char* out = &level.pixels[y * levelRowBytes + static_cast<size_t>(x) * components];
+			for (int k = 0; k < components; k++)
+			{
+				if (k < colorChannels)
+				{
+					float linear = (tables.toLinear[row0[x0 + k]] + tables.toLinear[row0[x1 + k]] +
+						tables.toLinear[row1[x0 + k]] + tables.toLinear[row1[x1 + k]]) * 0.25f;
+					out[k] = tables.fromLinear[static_cast<int>(linear * 4095.0f + 0.5f)];
+				}
+				else
+				{
+					int sum = row0[x0 + k] + row0[x1 + k] + row1[x0 + k] + row1[x1 + k];
+					out[k] = static_cast<unsigned char>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+	return level;
+}
+
+// Levels 1 to 1x1 below the image
+inline std::vector<MipLevel> buildMipChain(const unsigned char* pixels, int width, int height, int components, bool srgb)
+{
+	std::vector<MipLevel> levels;
+	const unsigned char* source = pixels;
+	while (source && (width > 1 || height > 1))
+	{
+		levels.push_back(downsampleLevel(source, width, height, components, srgb));
+		width = levels.back().width;
+		height = levels.back().height;
+		source = levels.back().pixels.data();
+	}
+	return levels;
+}
+
+// Levels of a full chain starting at width x height
+inline int mipLevelCount(int width, int height)
+{
+	int levels = 1;
+	while ((width >> levels) > 0 || (height >> levels) > 0)
+		levels++;
+	return levels;
+}
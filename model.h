@@ -1,236 +1,523 @@
 #pragma once
 
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
+#include <chrono>
+#include <functional>
+#include <memory>
 
 #include "mesh.h"
-#include "stb_image.h"
+#include "model_import.h"
+#include "mesh_format.h"
+#include "texture_cache.h"
+#include "texture_array.h"
+
+// Import settings only apply to source models, a baked .wmdl already carries their result
+struct ModelOptions : ImportOptions {
+	// Keep vertices and indices on the CPU after upload, only needed to edit or re-process meshes
+	bool keepCpuData = true;
+	// Static meshes share the pools of gpuArena rather than owning buffers
+	MeshStorage storage = MeshStorage::Arena;
+	// Material textures as layers of one texture array per type, bound once per draw
+	// of the model instead of per mesh. Falls back when a type mixes image sizes
+	bool textureArrays = false;
+};
 
+// What Model::Draw needs to pick a level of detail per mesh
+struct LodSelector {
+	// Eye to model distance in world units
+	double distance = 0.0;
+	// Uniform scale of the model matrix
+	double scale = 1.0;
+	// Viewport height / (2 tan(fov / 2)), pixels covered by one unit at distance 1
+	double projectionFactor = 1.0;
+	double maxPixelError = 1.0;
+};
 
-unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma = false);
+inline bool isBakedModelPath(const std::string& path)
+{
+	return path.size() > 5 && path.compare(path.size() - 5, 5, ".wmdl") == 0;
+}
 
 class Model
 {
 public:
 	Model() = default;
-	Model(char *path) 
+	// .wmdl files are read as baked by tools/model_baker, anything else goes through assimp
+	Model(char *path, ModelOptions a_options = ModelOptions()) 
 	{
+		options = a_options;
 		loadModel(path);
 	}
 
-	void Draw(GLuint& programId)
+	// Returns at once, the load runs across pollLoad calls. Meshes are drawable as soon as
+	// they are added, textures show a placeholder then sharpen as their levels stream in.
+	// onLoaded runs inside the pollLoad that finishes the load
+	void loadAsync(const std::string& path, ModelOptions a_options = ModelOptions(),
+		std::function<void(Model&)> onLoaded = {})
+	{
+		options = a_options;
+		this->path = path;
+		meshes.clear();
+		ownedTextures.clear();
+		textureArrays.clear();
+		instances.clearVertexArrays();
+		optimizeReport = MeshOptimizerReport();
+		loading = std::make_unique<PendingLoad>();
+		loading->path = path;
+		loading->onLoaded = std::move(onLoaded);
+		loading->start = std::chrono::steady_clock::now();
+	}
+
+	// Advances an async load by about budgetMilliseconds, call once per frame.
+	// The first call parses the file, later ones add processed meshes and upload textures.
+	// True once the model is fully loaded
+	bool pollLoad(double budgetMilliseconds = 4.0)
+	{
+		if (!loading)
+			return true;
+
+		auto start = std::chrono::steady_clock::now();
+		auto remaining = [&] {
+			return budgetMilliseconds - std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		PendingLoad& load = *loading;
+		if (!load.started)
+		{
+			load.started = true;
+			startLoad(load);
+			return false;
+		}
+
+		if (!addLoadedMeshes(load, remaining))
+			return false;
+		if (!load.texturesArranged)
+		{
+			load.texturesArranged = true;
+			buildTextureArrays();
+		}
+		if (!textureCache.pollLoads(std::max(remaining(), 0.0)))
+			return false;
+		if (options.textureArrays)
+		{
+			for (size_t i = 0; i < meshes.size(); i++)
+				meshes[i].setMaterial(meshes[i].textures, load.materialLayers[i]);
+		}
+
+		if (load.data && options.optimizeMeshes)
+			optimizeReport.print(load.path);
+		loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load.start).count();
+		printLoadSummary(load.path, load.importedMeshes);
+
+		std::function<void(Model&)> onLoaded = std::move(load.onLoaded);
+		loading.reset();
+		if (onLoaded)
+			onLoaded(*this);
+		return true;
+	}
+
+	bool isLoaded() const { return !loading; }
+
+	// Every transform in one draw per mesh. With a frustum, instances whose bounds are
+	// outside it are dropped before upload
+	void DrawInstanced(GLuint programId, const std::vector<InstanceTransform>& transforms, const Frustum* frustum = nullptr,
+		int lod = 0)
+	{
+		float boundsMin[3], boundsMax[3];
+		bounds(boundsMin, boundsMax);
+		if (instances.update(transforms, boundsMin, boundsMax, frustum) == 0)
+			return;
+		textureArrays.bind();
+		for (Mesh& mesh : meshes)
+			mesh.DrawInstanced(programId, instances, lod);
+	}
+
+	// Draw and DrawInstanced through a RenderQueue, one item per mesh on top of item.
+	// Items carry the texture arrays, the queue binds them as each one is issued
+	void Submit(RenderQueue& queue, const DrawItem& item, const LodSelector& selector)
+	{
+		double pixelsPerUnit = selector.scale * selector.projectionFactor / std::max(selector.distance, 1e-3);
+		DrawItem layered = item;
+		textureArrays.attach(layered);
+		for (Mesh& mesh : meshes)
+			queue.submit(mesh.queueItem(layered, mesh.selectLod(pixelsPerUnit, selector.maxPixelError)));
+	}
+
+	void SubmitInstanced(RenderQueue& queue, const DrawItem& item, const std::vector<InstanceTransform>& transforms,
+		const Frustum* frustum = nullptr, int lod = 0)
+	{
+		float boundsMin[3], boundsMax[3];
+		bounds(boundsMin, boundsMax);
+		if (instances.update(transforms, boundsMin, boundsMax, frustum) == 0)
+			return;
+		DrawItem layered = item;
+		textureArrays.attach(layered);
+		for (Mesh& mesh : meshes)
+			queue.submit(mesh.queueInstancedItem(layered, instances, lod));
+	}
+
+	// Union of the mesh bounds in model space
+	void bounds(float boundsMin[3], float boundsMax[3]) const
 	{
+		for (int c = 0; c < 3; c++)
+		{
+			boundsMin[c] = meshes.empty() ? 0.0f : meshes[0].boundsMin[c];
+			boundsMax[c] = meshes.empty() ? 0.0f : meshes[0].boundsMax[c];
+			for (const Mesh& mesh : meshes)
+			{
+				boundsMin[c] = std::min(boundsMin[c], mesh.boundsMin[c]);
+				boundsMax[c] = std::max(boundsMax[c], mesh.boundsMax[c]);
+			}
+		}
+	}
+
+	void Draw(GLuint programId)
+	{
+		textureArrays.bind();
 		for (unsigned int i = 0; i < meshes.size(); i++)
 		{
 			meshes[i].Draw(programId);
 		}
 	}
 
+	void Draw(GLuint programId, const LodSelector& selector)
+	{
+		double pixelsPerUnit = selector.scale * selector.projectionFactor / std::max(selector.distance, 1e-3);
+		textureArrays.bind();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+		{
+			meshes[i].Draw(programId, meshes[i].selectLod(pixelsPerUnit, selector.maxPixelError));
+		}
+	}
+
 	std::vector<Mesh> meshes;
+	// File the model was loaded from
+	std::string path;
 	std::string directory;
-	std::vector<Texture> textures_loaded;
+	// Meshes only reference texture ids, the model holds them in textureCache
+	std::vector<SharedTexture> ownedTextures;
 	bool gammaCorrection;
+	ModelOptions options;
+	// Vertex cache stats of all meshes before and after optimization
+	MeshOptimizerReport optimizeReport;
+	// Wall time of the whole load, parsing, processing, texture decode and upload
+	double loadMilliseconds = 0.0;
+	// Async loads only, the time from loadAsync until the first mesh was added
+	double firstMeshMilliseconds = 0.0;
+
+	// Meshes and instance buffer, the textures are reported by textureCache
+	AssetMemory memoryUsage() const
+	{
+		AssetMemory usage;
+		usage.subsystem = "Models";
+		usage.name = path;
+		usage.cpuBytes = vectorBytes(meshes) + vectorBytes(ownedTextures) + instances.cpuBytes();
+		usage.gpuBytes = instances.gpuBytes();
+		for (const Mesh& mesh : meshes)
+		{
+			usage.cpuBytes += mesh.cpuBytes();
+			usage.gpuBytes += mesh.gpuBytes();
+		}
+		usage.count = static_cast<unsigned int>(meshes.size());
+		return usage;
+	}
 
+	Model(const Model&) = delete;
+	Model& operator=(const Model&) = delete;
+	Model(Model&&) = default;
+	Model& operator=(Model&&) = default;
 	~Model() {}
 
 private:
+	// Result of processing one mesh of an imported model on the pool
+	struct ProcessedMesh {
+		size_t index = 0;
+		MeshOptimizerReport report;
+	};
+
+	// State of a loadAsync in flight. Jobs only share data and processed, so the
+	// model can move or go away while they run
+	struct PendingLoad {
+		std::string path;
+		std::function<void(Model&)> onLoaded;
+		std::chrono::steady_clock::time_point start;
+		bool started = false;
+		size_t importedMeshes = 0;
+		bool texturesArranged = false;
+		// With texture arrays, meshes sample this until every layer is in, then switch
+		// to materialLayers, one per mesh
+		GLTexture placeholder;
+		std::vector<GLint> materialLayers;
+
+		std::unique_ptr<BakedModel> baked;
+		size_t nextBaked = 0;
+
+		std::shared_ptr<ModelData> data;
+		std::shared_ptr<CompletionQueue<ProcessedMesh>> processed;
+		size_t processing = 0;
+	};
+
+	std::unique_ptr<PendingLoad> loading;
+	// Transforms of the last DrawInstanced
+	InstanceBuffer instances;
+	// Layers of every material, with options.textureArrays
+	TextureArrayBuilder textureArrays;
 
 	void loadModel(std::string path)
 	{
-		Assimp::Importer importer;
-		const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+		this->path = path;
+		textureArrays.clear();
+		auto start = std::chrono::steady_clock::now();
 
-		if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
-		{
-			std::cout << "ERROR ASSIMP: " << importer.GetErrorString() << std::endl;
-		}
-		
-		directory = path.substr(0, path.find_last_of('/'));
-		processNode(scene->mRootNode, scene);
+		size_t importedMeshes = isBakedModelPath(path) ? loadBaked(path) : loadImported(path);
 
+		loadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		printLoadSummary(path, importedMeshes);
 	}
 
-	void processNode(aiNode* node, const aiScene* scene)
+	void printLoadSummary(const std::string& path, size_t importedMeshes) const
 	{
-		// Process each node then each children
-		for (unsigned int i = 0; i < node->mNumMeshes; i++)
-		{
-			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-			meshes.push_back(processMesh(mesh, scene));
-		}
-		for(unsigned int i = 0; i < node->mNumChildren; i++)
+		std::cout << path << ": " << importedMeshes << " meshes drawn in " << meshes.size() << " draw calls, loaded in "
+			<< loadMilliseconds << " ms" << std::endl;
+
+		if (lodCount() > 1)
 		{
-			processNode(node->mChildren[i], scene);
+			std::vector<unsigned int> lodTriangles;
+			for (const Mesh& mesh : meshes)
+			{
+				for (size_t l = 0; l < mesh.lods.size(); l++)
+				{
+					if (l >= lodTriangles.size())
+						lodTriangles.push_back(0);
+					lodTriangles[l] += mesh.lods[l].count / 3;
+				}
+			}
+			std::cout << path << " LOD triangles:";
+			for (unsigned int count : lodTriangles)
+				std::cout << " " << count;
+			std::cout << std::endl;
 		}
 	}
 
-	Mesh processMesh(aiMesh* mesh, const aiScene* scene)
+	size_t lodCount() const
 	{
-		std::vector<Vertex> vertices;
-		std::vector<unsigned int> indices;
-		std::vector<Texture> textures;
-
-		// walk mesh vertices
-		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
-		{
-			Vertex vertex;
-			float values[3];
-			// Note, will use same array to populate different data in vertex
-			// positions
-			values[0] = mesh->mVertices[i].x;
-			values[1] = mesh->mVertices[i].y;
-			values[2] = mesh->mVertices[i].z;
-			vertex.Pos[0] = values[0];
-			vertex.Pos[1] = values[1];
-			vertex.Pos[2] = values[2];
-
-			// normals
-			if (mesh->HasNormals())
-			{
-				values[0] = mesh->mNormals[i].x;
-				values[1] = mesh->mNormals[i].y;
-				values[2] = mesh->mNormals[i].z;
-				vertex.Normal[0] = values[0];
-				vertex.Normal[1] = values[1];
-				vertex.Normal[2] = values[2];
-			}
+		size_t count = 0;
+		for (const Mesh& mesh : meshes)
+			count = std::max(count, mesh.lods.size());
+		return count;
+	}
 
-			// Texture
-			if (mesh->mTextureCoords[0])
-			{
-				float val[2];
-
-				val[0] = mesh->mTextureCoords[0][i].x;
-				val[1] = mesh->mTextureCoords[0][i].y;
-				
-				vertex.TexUV[0] = val[0];
-				vertex.TexUV[1] = val[1];
-				// TODO add tan and bitan here
-			}
-			else
+	// Parsing stays on the main thread, workers never go through the file system.
+	// Imported meshes are then optimized and simplified one job each
+	void startLoad(PendingLoad& load)
+	{
+		if (isBakedModelPath(load.path))
+		{
+			load.baked = std::make_unique<BakedModel>();
+			if (!load.baked->load(load.path))
 			{
-				vertex.TexUV[0] = 0.0;
-				vertex.TexUV[1] = 0.0;
+				std::cout << "ERROR: " << load.path << " is not a baked model of version " << BAKED_MODEL_VERSION << std::endl;
+				load.baked->meshes.clear();
+				return;
 			}
-
-			vertices.push_back(vertex);
+			directory = load.path.substr(0, load.path.find_last_of('/'));
+			load.importedMeshes = load.baked->header.importedMeshes;
+			return;
 		}
-		// Walk mesh faces
-		for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+
+		load.data = std::make_shared<ModelData>();
+		load.processed = std::make_shared<CompletionQueue<ProcessedMesh>>();
+		if (!importModel(load.path, *load.data, options.profile))
+			return;
+		load.data->importReport.print(load.path);
+		directory = load.data->directory;
+		load.importedMeshes = load.data->importedMeshes;
+		if (options.mergeByMaterial)
+			load.data->meshes = mergeMeshesByMaterial(std::move(load.data->meshes));
+
+		ImportOptions importOptions = options;
+		for (size_t i = 0; i < load.data->meshes.size(); i++)
 		{
-			aiFace face = mesh->mFaces[i];
-			for (unsigned int j = 0; j < face.mNumIndices; j++)
-			{
-				indices.push_back(face.mIndices[j]);
-			}
+			std::shared_ptr<ModelData> data = load.data;
+			std::shared_ptr<CompletionQueue<ProcessedMesh>> processed = load.processed;
+			threadPool().submit([data, processed, importOptions, i] {
+				processed->push({ i, processMeshData(data->meshes[i], importOptions) });
+			});
 		}
+		load.processing = load.data->meshes.size();
+	}
 
-		// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-		// Directly from learnOpenGL at the moment
-		// TODO: IMPROVE TEXTURE LOADING
-        // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
-        // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
-        // Same applies to other texture as the following list summarizes:
-        // diffuse: texture_diffuseN
-        // specular: texture_specularN
-        // normal: texture_normalN
-
-		if (mesh->mMaterialIndex >= 0)
-		{
-			aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-			// 1. diffuse maps
-			std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-			textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-			// 2. specular maps
-			std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-			/* FOR LATER USE 
-			// 3. normal maps
-			std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-			textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-			// 4. height maps
-			std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-			textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-			*/
-		}
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
-	}
-
-	std::vector<Texture> loadMaterialTextures(aiMaterial* mat,
-		aiTextureType type, std::string typeName)
+	// Adds meshes as they are ready until the budget runs out, at least one per call.
+	// True once every mesh is in
+	template <typename Remaining>
+	bool addLoadedMeshes(PendingLoad& load, Remaining remaining)
 	{
-		std::vector<Texture> textures;
-		for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+		size_t before = meshes.size();
+		if (load.baked)
 		{
-			aiString str;
-			mat->GetTexture(type, i, &str);
-			bool skip = false;
-			for (unsigned int j = 0; j < textures_loaded.size(); j++)
-			{
-				if (std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-				{
-					textures.push_back(textures_loaded[j]);
-					skip = true;
-					break;
-				}
-			}
-			if (!skip)
-			{
-				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
-				texture.type = typeName;
-				texture.path = str.C_Str();
-				textures.push_back(texture);
-				textures_loaded.push_back(texture);
+			const std::vector<BakedMesh>& records = load.baked->meshes;
+			while (load.nextBaked < records.size() && (meshes.size() == before || remaining() > 0))
+				addBakedMesh(*load.baked, records[load.nextBaked++]);
+		}
+		else if (load.processing > 0)
+		{
+			// Without workers the mesh jobs only run here
+			threadPool().runFor(std::max(remaining(), 0.0));
 
+			ProcessedMesh processed;
+			while (load.processing > 0 && (meshes.size() == before || remaining() > 0) && load.processed->tryPop(processed))
+			{
+				load.processing--;
+				optimizeReport.add(processed.report);
+				addImportedMesh(load.data->meshes[processed.index]);
 			}
 		}
-		return textures;
+
+		if (before == 0 && meshes.size() > 0)
+			firstMeshMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load.start).count();
+		return load.baked ? load.nextBaked == load.baked->meshes.size() : load.processing == 0;
 	}
 
-};
+	// Source model through assimp, processed and packed at load
+	size_t loadImported(const std::string& path)
+	{
+		ModelData data;
+		if (!importModel(path, data, options.profile))
+			return 0;
+		data.importReport.print(path);
+		directory = data.directory;
 
-unsigned int TextureFromFile(const char* path, const std::string& directory, bool gamma)
-{
-	std::string filename = std::string(path);
-	filename = directory + '/' + filename;
+		processModelData(data, options);
+		optimizeReport = data.optimizeReport;
 
-	unsigned int textureId;
-	glGenTextures(1, &textureId);
+		// Images decode on the worker threads while the meshes are processed and uploaded
+		for (MeshData& mesh : data.meshes)
+			addImportedMesh(mesh);
+		buildTextureArrays();
+		textureCache.finishLoads();
 
-	int width, height, numComponents;
-	unsigned char* data = stbi_load(filename.c_str(), &width, &height, &numComponents, 0);
+		if (options.optimizeMeshes)
+			optimizeReport.print(path);
+
+		return data.importedMeshes;
+	}
+
+	void addImportedMesh(MeshData& mesh)
+	{
+		meshes.emplace_back(std::move(mesh.vertices), std::move(mesh.indices), loadTextures(mesh.textures),
+			options.vertexFormat, std::move(mesh.lods), options.storage);
+		addMaterialLayer(meshes.back());
+		if (!options.keepCpuData)
+			meshes.back().releaseCpuData();
+	}
 
-	if (data)
+	// Baked model, vertices and indices go from the file buffer to GL untouched
+	size_t loadBaked(const std::string& path)
 	{
-		GLenum format;
-		if (numComponents == 1)
-			format = GL_RED;
-		else if (numComponents == 3)
-			format = GL_RGB;
-		else if (numComponents == 4)
-			format = GL_RGBA;
+		BakedModel baked;
+		if (!baked.load(path))
+		{
+			std::cout << "ERROR: " << path << " is not a baked model of version " << BAKED_MODEL_VERSION << std::endl;
+			return 0;
+		}
+		directory = path.substr(0, path.find_last_of('/'));
 
-		glBindTexture(GL_TEXTURE_2D, textureId);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		for (const BakedMesh& record : baked.meshes)
+			addBakedMesh(baked, record);
+		buildTextureArrays();
+		textureCache.finishLoads();
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		return baked.header.importedMeshes;
+	}
 
-		stbi_image_free(data);
+	void addBakedMesh(const BakedModel& baked, const BakedMesh& record)
+	{
+		GpuMeshData data;
+		data.format = static_cast<VertexFormat>(record.format);
+		data.indexType = record.indexType;
+		data.vertexData = baked.vertexData(record);
+		data.vertexCount = static_cast<GLsizei>(record.vertexCount);
+		data.indexData = baked.indexData(record);
+		data.indexCount = static_cast<GLsizei>(record.indexCount);
+		for (int c = 0; c < 3; c++)
+		{
+			data.boundsMin[c] = record.boundsMin[c];
+			data.boundsMax[c] = record.boundsMax[c];
+			data.posScale[c] = record.posScale[c];
+			data.posOffset[c] = record.posOffset[c];
+		}
+		for (uint32_t l = record.firstLod; l < record.firstLod + record.lodCount; l++)
+		{
+			const BakedLod& lod = baked.lods[l];
+			data.lods.push_back({ static_cast<GLsizei>(lod.first), static_cast<GLsizei>(lod.count), lod.error });
+		}
+
+		std::vector<TextureRef> textureRefs;
+		for (uint32_t t = record.firstTexture; t < record.firstTexture + record.textureCount; t++)
+			textureRefs.push_back({ baked.string(baked.textures[t].path), baked.string(baked.textures[t].type) });
+
+		meshes.emplace_back(data, loadTextures(textureRefs), options.storage);
+		addMaterialLayer(meshes.back());
 	}
-	else
+
+	// Shared through textureCache, the returned ids hold a placeholder until their levels stream in.
+	// With texture arrays only the names are kept, the arrays load once every mesh is in and
+	// async loads point every map at the load's placeholder until then
+	std::vector<Texture> loadTextures(const std::vector<TextureRef>& refs)
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		std::vector<Texture> textures;
+		for (const TextureRef& ref : refs)
+		{
+			Texture texture;
+			texture.id = 0;
+			if (!options.textureArrays)
+			{
+				ownedTextures.push_back(textureCache.load(this->directory + '/' + ref.path, true, ref.type == "texture_diffuse"));
+				texture.id = ownedTextures.back();
+			}
+			else if (loading)
+			{
+				if (!loading->placeholder.get())
+				{
+					loading->placeholder = createGLTexture();
+					uploadPlaceholder(loading->placeholder);
+				}
+				texture.id = loading->placeholder;
+			}
+			texture.type = ref.type;
+			texture.path = ref.path;
+			textures.push_back(texture);
+		}
+		return textures;
 	}
 
-	return textureId;
+	// Async loads keep the mesh on its placeholder, arrays read black until their layers land
+	void addMaterialLayer(Mesh& mesh)
+	{
+		if (!options.textureArrays)
+			return;
+		GLint layer = textureArrays.addMaterial(mesh.textures);
+		if (loading)
+			loading->materialLayers.push_back(layer);
+		else
+			mesh.setMaterial(mesh.textures, layer);
+	}
 
-}
+	// Every material is known once the meshes are in. Images of one type that differ in
+	// size cannot share an array, then every mesh binds its own textures after all
+	void buildTextureArrays()
+	{
+		if (!options.textureArrays || textureArrays.build(directory))
+			return;
 
+		std::cout << path << ": material textures differ in size, drawn without texture arrays" << std::endl;
+		options.textureArrays = false;
+		textureArrays.clear();
+		for (Mesh& mesh : meshes)
+		{
+			std::vector<TextureRef> refs;
+			for (const Texture& texture : mesh.textures)
+				refs.push_back({ texture.path, texture.type });
+			mesh.setMaterial(loadTextures(refs));
+		}
+	}
+};
@@ -0,0 +1,357 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <GLES3/gl3.h>
+
+#ifdef USE_ASSIMP
+#include <assimp/Importer.hpp>
+#include <assimp/config.h>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#endif
+
+#include "vertex.h"
+#include "mesh_optimizer.h"
+#include "simplify.h"
+#include "tangent_space.h"
+
+// CPU side of model loading, no GL calls, shared by Model and the offline baker.
+// Textures are only referenced by path here, Model turns them into GL textures.
+
+// Assimp post-processing presets, from the data as authored to the most work at import
+enum class ImportProfile {
+	// Triangulate and flip UVs only, every face corner stays its own vertex
+	Raw,
+	// Welds identical vertices and splits meshes to fit 16 bit indices, cache order is left
+	// to processModelData
+	Fast,
+	// Fast plus missing normals, cache order and fewer meshes
+	Balanced,
+	// Balanced plus a flattened node graph, tangent space and data cleanup
+	Quality
+};
+
+inline const char* importProfileName(ImportProfile profile)
+{
+	switch (profile)
+	{
+	case ImportProfile::Raw: return "raw";
+	case ImportProfile::Fast: return "fast";
+	case ImportProfile::Balanced: return "balanced";
+	case ImportProfile::Quality: return "quality";
+	default: return "unknown";
+	}
+}
+
+inline bool parseImportProfile(const char* name, ImportProfile& profile)
+{
+	for (ImportProfile candidate : { ImportProfile::Raw, ImportProfile::Fast, ImportProfile::Balanced, ImportProfile::Quality })
+	{
+		if (std::strcmp(name, importProfileName(candidate)) == 0)
+		{
+			profile = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+// What one import produced, before any merging or optimization of ours
+struct ImportReport {
+	ImportProfile profile = ImportProfile::Balanced;
+	double milliseconds = 0.0;
+	size_t vertices = 0;
+	size_t indices = 0;
+	// One draw call per mesh
+	size_t meshes = 0;
+
+	void print(const std::string& name) const
+	{
+		std::cout << name << " (" << importProfileName(profile) << " import): " << milliseconds << " ms, " << vertices
+			<< " verts, " << indices << " indices, " << meshes << " draws" << std::endl;
+	}
+};
+
+struct ImportOptions {
+	// Assimp post-processing, ignored for baked models
+	ImportProfile profile = ImportProfile::Balanced;
+	VertexFormat vertexFormat = VertexFormat::Float;
+	// Reorder triangles and vertices for the post transform cache, overdraw and fetch
+	bool optimizeMeshes = true;
+	// Extra simplified levels per mesh, 0 keeps only the authored triangles
+	int lodLevels = 0;
+	MeshLodOptions lod;
+	// One mesh per material, so the model draws in as many calls as it has materials
+	bool mergeByMaterial = false;
+};
+
+// Texture file relative to the model directory, type is the sampler prefix, texture_diffuse...
+struct TextureRef {
+	std::string path;
+	std::string type;
+};
+
+// Mesh data on the CPU, before upload
+struct MeshData {
+	std::vector<Vertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<TextureRef> textures;
+	unsigned int materialIndex = 0;
+	// Tangents came with the file, otherwise processModelData computes them
+	bool hasTangents = false;
+	// Filled by processModelData when LODs are requested
+	std::vector<MeshLod> lods;
+};
+
+struct ModelData {
+	std::string directory;
+	std::vector<MeshData> meshes;
+	// Mesh count as authored, before merging
+	size_t importedMeshes = 0;
+	ImportReport importReport;
+	// Vertex cache stats of all meshes before and after optimization
+	MeshOptimizerReport optimizeReport;
+};
+
+// Concatenates meshes sharing a material. WebGL2 has no base vertex draws,
+// so each mesh's vertex offset is added to its indices instead
+inline std::vector<MeshData> mergeMeshesByMaterial(std::vector<MeshData> meshData)
+{
+	std::vector<MeshData> merged;
+	for (MeshData& data : meshData)
+	{
+		MeshData* target = nullptr;
+		for (MeshData& candidate : merged)
+		{
+			if (candidate.materialIndex == data.materialIndex)
+			{
+				target = &candidate;
+				break;
+			}
+		}
+
+		if (!target)
+		{
+			merged.push_back(std::move(data));
+			continue;
+		}
+
+		target->hasTangents = target->hasTangents && data.hasTangents;
+		GLuint baseVertex = static_cast<GLuint>(target->vertices.size());
+		target->vertices.insert(target->vertices.end(), data.vertices.begin(), data.vertices.end());
+		target->indices.reserve(target->indices.size() + data.indices.size());
+		for (GLuint index : data.indices)
+			target->indices.push_back(index + baseVertex);
+	}
+	return merged;
+}
+
+// Tangents if missing, then optimize and simplify one mesh as asked, touches nothing else so meshes can be
+// processed on different threads
+inline MeshOptimizerReport processMeshData(MeshData& data, const ImportOptions& options)
+{
+	if (!data.hasTangents)
+	{
+		computeTangents(data.vertices, data.indices);
+		data.hasTangents = true;
+	}
+
+	MeshOptimizerReport report;
+	if (options.optimizeMeshes)
+		report = optimizeMesh(data.vertices, data.indices);
+
+	if (options.lodLevels > 0)
+	{
+		MeshLodOptions lodOptions = options.lod;
+		lodOptions.levels = options.lodLevels;
+		data.lods = buildLodChain(data.vertices, data.indices, lodOptions);
+	}
+	return report;
+}
+
+// Merge, optimize and simplify as asked, the vertex format is only applied at upload or bake
+inline void processModelData(ModelData& model, const ImportOptions& options)
+{
+	if (options.mergeByMaterial)
+		model.meshes = mergeMeshesByMaterial(std::move(model.meshes));
+
+	for (MeshData& data : model.meshes)
+		model.optimizeReport.add(processMeshData(data, options));
+}
+
+#ifdef USE_ASSIMP
+
+inline void importMaterialTextures(aiMaterial* mat, aiTextureType type, const std::string& typeName,
+	std::vector<TextureRef>& textures)
+{
+	for (unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+	{
+		aiString str;
+		mat->GetTexture(type, i, &str);
+		textures.push_back({ str.C_Str(), typeName });
+	}
+}
+
+inline MeshData importMesh(aiMesh* mesh, const aiScene* scene)
+{
+	MeshData data;
+	data.vertices.reserve(mesh->mNumVertices);
+
+	// walk mesh vertices
+	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+	{
+		Vertex vertex;
+		vertex.Pos[0] = mesh->mVertices[i].x;
+		vertex.Pos[1] = mesh->mVertices[i].y;
+		vertex.Pos[2] = mesh->mVertices[i].z;
+
+		// normals
+		if (mesh->HasNormals())
+		{
+			vertex.Normal[0] = mesh->mNormals[i].x;
+			vertex.Normal[1] = mesh->mNormals[i].y;
+			vertex.Normal[2] = mesh->mNormals[i].z;
+		}
+
+		// Texture
+		if (mesh->mTextureCoords[0])
+		{
+			vertex.TexUV[0] = mesh->mTextureCoords[0][i].x;
+			vertex.TexUV[1] = mesh->mTextureCoords[0][i].y;
+		}
+		else
+		{
+			vertex.TexUV[0] = 0.0;
+			vertex.TexUV[1] = 0.0;
+		}
+
+		// Only with the quality profile, the sign says whether the UVs are mirrored
+		if (mesh->HasTangentsAndBitangents() && mesh->HasNormals())
+		{
+			const aiVector3D& t = mesh->mTangents[i];
+			const aiVector3D& b = mesh->mBitangents[i];
+			const aiVector3D& n = mesh->mNormals[i];
+			float cross[3] = { n.y * t.z - n.z * t.y, n.z * t.x - n.x * t.z, n.x * t.y - n.y * t.x };
+			vertex.Tangent[0] = t.x;
+			vertex.Tangent[1] = t.y;
+			vertex.Tangent[2] = t.z;
+			vertex.Tangent[3] = cross[0] * b.x + cross[1] * b.y + cross[2] * b.z < 0.0f ? -1.0f : 1.0f;
+		}
+
+		data.vertices.push_back(vertex);
+	}
+	// Walk mesh faces
+	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+	{
+		aiFace face = mesh->mFaces[i];
+		for (unsigned int j = 0; j < face.mNumIndices; j++)
+		{
+			data.indices.push_back(face.mIndices[j]);
+		}
+	}
+
+	// we assume a convention for sampler names in the shaders. Each diffuse texture should be named
+	// as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER.
+	// Same applies to other texture as the following list summarizes:
+	// diffuse: texture_diffuseN
+	// specular: texture_specularN
+	// normal: texture_normalN
+	// height: texture_heightN
+	if (mesh->mMaterialIndex < scene->mNumMaterials)
+	{
+		aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];
+		importMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data.textures);
+		importMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data.textures);
+		// OBJ map_Bump lands in HEIGHT, and is a normal map in nearly every exported model
+		importMaterialTextures(material, aiTextureType_NORMALS, "texture_normal", data.textures);
+		importMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", data.textures);
+		importMaterialTextures(material, aiTextureType_DISPLACEMENT, "texture_height", data.textures);
+	}
+	data.materialIndex = mesh->mMaterialIndex;
+	data.hasTangents = mesh->HasTangentsAndBitangents() && mesh->HasNormals();
+	return data;
+}
+
+inline void importNode(aiNode* node, const aiScene* scene, std::vector<MeshData>& meshData)
+{
+	// Process each node then each children
+	for (unsigned int i = 0; i < node->mNumMeshes; i++)
+	{
+		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+		meshData.push_back(importMesh(mesh, scene));
+	}
+	for (unsigned int i = 0; i < node->mNumChildren; i++)
+	{
+		importNode(node->mChildren[i], scene, meshData);
+	}
+}
+
+inline unsigned int importProfileFlags(ImportProfile profile)
+{
+	unsigned int flags = aiProcess_Triangulate | aiProcess_FlipUVs;
+	if (profile == ImportProfile::Raw)
+		return flags;
+
+	flags |= aiProcess_JoinIdenticalVertices | aiProcess_SplitLargeMeshes;
+	if (profile == ImportProfile::Fast)
+		return flags;
+
+	flags |= aiProcess_GenSmoothNormals | aiProcess_ImproveCacheLocality | aiProcess_SortByPType |
+		aiProcess_RemoveRedundantMaterials | aiProcess_OptimizeMeshes;
+	if (profile == ImportProfile::Balanced)
+		return flags;
+
+	return flags | aiProcess_OptimizeGraph | aiProcess_CalcTangentSpace | aiProcess_FindDegenerates |
+		aiProcess_FindInvalidData | aiProcess_ValidateDataStructure;
+}
+
+// Reads any format assimp was built with, false when the file could not be parsed
+inline bool importModel(const std::string& path, ModelData& model, ImportProfile profile = ImportProfile::Balanced)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	Assimp::Importer importer;
+	// Split meshes stay within 16 bit indices, which Mesh then uploads
+	importer.SetPropertyInteger(AI_CONFIG_PP_SLM_VERTEX_LIMIT, 65536);
+	// Degenerate lines and points would only be dropped later, SortByPType separates them
+	importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+	const aiScene* scene = importer.ReadFile(path, importProfileFlags(profile));
+
+	if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+	{
+		std::cout << "ERROR ASSIMP: " << importer.GetErrorString() << std::endl;
+		return false;
+	}
+
+	model.directory = path.substr(0, path.find_last_of('/'));
+	importNode(scene->mRootNode, scene, model.meshes);
+	model.importedMeshes = model.meshes.size();
+
+	ImportReport& report = model.importReport;
+	report = ImportReport();
+	report.profile = profile;
+	report.meshes = model.meshes.size();
+	for (const MeshData& mesh : model.meshes)
+	{
+		report.vertices += mesh.vertices.size();
+		report.indices += mesh.indices.size();
+	}
+	report.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+#else
+
+inline bool importModel(const std::string& path, ModelData& model, ImportProfile profile = ImportProfile::Balanced)
+{
+	(void)model;
+	(void)profile;
+	std::cout << "ERROR: built without assimp, bake " << path << " with model_baker first" << std::endl;
+	return false;
+}
+
+#endif
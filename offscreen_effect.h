@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+#include "gl_state.h"
+#include "stats.h"
+
+// Screen space effect too costly to shade every pixel of every frame. It renders into a
+// texture at scale times the framebuffer size, at most updateHz times a second, and
+// the geometry showing it samples that texture by gl_FragCoord. The target follows the
+// framebuffer size, and frames where nothing shows the effect skip it entirely.
+// Given the screen area of that geometry, renders are scissored to it so their cost
+// follows coverage. Target pixels outside keep older contents, a render is due early
+// when the area grows past what the last one covered.
+
+class OffscreenEffect {
+public:
+	// Fraction of the framebuffer size on each axis
+	float scale = 0.5f;
+	// Renders per second, 0 renders every frame
+	double updateHz = 30.0;
+
+	// Called every frame the effect is visible, coverage is the framebuffer rectangle
+	// showing it as x, y, width, height, or null for all of it. Resizes the target to follow
+	// the framebuffer and, when a render is due, binds it, its viewport and the scissor box
+	// and returns true. The caller then draws the effect over the whole target and calls end()
+	bool begin(int framebufferWidth, int framebufferHeight, double now, const int* coverage = nullptr)
+	{
+		int targetWidth = std::max(1, static_cast<int>(framebufferWidth * scale));
+		int targetHeight = std::max(1, static_cast<int>(framebufferHeight * scale));
+		if (targetWidth != width || targetHeight != height || !framebuffer.get())
+		{
+			allocate(targetWidth, targetHeight);
+			current = false;
+		}
+
+		int area[4] = { 0, 0, width, height };
+		if (coverage)
+			scaleToTarget(coverage, area);
+		countRenders(now);
+		// A millisecond of slack, frames at twice updateHz land just short of the interval
+		bool due = !current || updateHz <= 0.0 || now - lastRender >= 1.0 / updateHz - 0.001;
+		if (!due && contains(rendered, area))
+			return false;
+
+		// A margin so small camera moves stay inside until the next render
+		if (coverage)
+		{
+			int right = std::min(width, area[0] + area[2] + SCISSOR_MARGIN);
+			int top = std::min(height, area[1] + area[3] + SCISSOR_MARGIN);
+			area[0] = std::max(0, area[0] - SCISSOR_MARGIN);
+			area[1] = std::max(0, area[1] - SCISSOR_MARGIN);
+			area[2] = right - area[0];
+			area[3] = top - area[1];
+		}
+		std::copy(area, area + 4, rendered);
+
+		glState.bindFramebuffer(framebuffer);
+		glState.viewport(0, 0, width, height);
+		glState.setEnabled(GL_SCISSOR_TEST, true);
+		glState.scissor(area[0], area[1], area[2], area[3]);
+		lastRender = now;
+		current = true;
+		windowRenders++;
+		return true;
+	}
+
+	// Back to the default framebuffer and its viewport, scissor off
+	void end(int framebufferWidth, int framebufferHeight)
+	{
+		glState.setEnabled(GL_SCISSOR_TEST, false);
+		glState.bindFramebuffer(0);
+		glState.viewport(0, 0, framebufferWidth, framebufferHeight);
+	}
+
+	// Called on frames the effect is not visible, the next visible frame renders it anew
+	void skip(double now)
+	{
+		current = false;
+		countRenders(now);
+	}
+
+	GLuint texture() const { return target.get(); }
+	int targetWidth() const { return width; }
+	int targetHeight() const { return height; }
+	// Target pixels the last render shaded
+	int renderedWidth() const { return rendered[2]; }
+	int renderedHeight() const { return rendered[3]; }
+	// Over the last whole second
+	double rendersPerSecond() const { return renderRate; }
+
+private:
+	// In target pixels
+	static const int SCISSOR_MARGIN = 8;
+
+	GLFramebuffer framebuffer;
+	GLTexture target;
+	int width = 0;
+	int height = 0;
+	double lastRender = 0.0;
+	bool current = false;
+	// Scissor box of the last render
+	int rendered[4] = {};
+	double windowStart = 0.0;
+	unsigned int windowRenders = 0;
+	double renderRate = 0.0;
+
+	void scaleToTarget(const int* coverage, int* area) const
+	{
+		int left = static_cast<int>(std::floor(coverage[0] * scale));
+		int bottom = static_cast<int>(std::floor(coverage[1] * scale));
+		int right = static_cast<int>(std::ceil((coverage[0] + coverage[2]) * scale));
+		int top = static_cast<int>(std::ceil((coverage[1] + coverage[3]) * scale));
+		area[0] = std::min(std::max(left, 0), width);
+		area[1] = std::min(std::max(bottom, 0), height);
+		area[2] = std::max(0, std::min(right, width) - area[0]);
+		area[3] = std::max(0, std::min(top, height) - area[1]);
+	}
+
+	static bool contains(const int* outer, const int* inner)
+	{
+		return inner[0] >= outer[0] && inner[1] >= outer[1] && inner[0] + inner[2] <= outer[0] + outer[2] &&
+			inner[1] + inner[3] <= outer[1] + outer[3];
+	}
+
+	// Rolls the renders per second window once a second has passed
+	void countRenders(double now)
+	{
+		if (now - windowStart < 1.0)
+			return;
+		renderRate = windowStart > 0.0 ? windowRenders / (now - windowStart) : 0.0;
+		windowStart = now;
+		windowRenders = 0;
+	}
+
+	// Immutable storage cannot be resized, a new size gets a new texture
+	void allocate(int targetWidth, int targetHeight)
+	{
+		width = targetWidth;
+		height = targetHeight;
+		if (!framebuffer.get())
+			framebuffer = createGLFramebuffer();
+
+		target = createGLTexture();
+		glState.bindTexture(GL_TEXTURE_2D, target);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		target.setBytes(textureBytes(width, height, 4, false));
+
+		glState.bindFramebuffer(framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR: offscreen effect target " << width << "x" << height << " is incomplete" << std::endl;
+		glState.bindFramebuffer(0);
+		frameStats.glCalls += 8;
+	}
+};
@@ -0,0 +1,175 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+
+#include "imgui.h"
+#include "imgui_impl_glfw.h"
+#include "imgui_impl_opengl3.h"
+#include "stats.h"
+#include "gl_resource.h"
+#include "gpu_arena.h"
+#include "texture_cache.h"
+#include "memory_stats.h"
+#include "offscreen_effect.h"
+
+// ImGui frame shared by every window drawn in a loop() iteration
+inline void beginUIFrame()
+{
+	glfwSwapInterval(1); // Enable vsync
+
+	// Start the Dear ImGui frame
+	ImGui_ImplOpenGL3_NewFrame();
+	ImGui_ImplGlfw_NewFrame();
+	ImGui::NewFrame();
+}
+
+inline void endUIFrame(GLFWwindow* window)
+{
+	// Rendering
+	ImGui::Render();
+	int display_w, display_h;
+	glfwGetFramebufferSize(window, &display_w, &display_h);
+	glViewport(0, 0, display_w, display_h);
+	ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+	// The backend restores what it changes but through raw GL, glState cannot tell
+	glState.invalidate();
+
+	glfwSwapBuffers(window);
+}
+
+// Small stats window toggled with O, used to check GPU residency stays flat over time
+class DebugOverlay {
+public:
+	// collectMemory builds the report of the Memory window, called at most once per
+	// MEMORY_REFRESH_SECONDS while that window is open, or on its Refresh button
+	void Draw(MemoryReport (*collectMemory)(), double now)
+	{
+		long long total = gpuResources.totalBytes();
+		if (total > peakBytes)
+			peakBytes = total;
+
+		ImGui::SetNextWindowPos(ImVec2(10, 10), ImGuiCond_FirstUseEver);
+		ImGui::SetNextWindowBgAlpha(0.6f);
+		ImGui::Begin("Stats", &visible, ImGuiWindowFlags_AlwaysAutoResize);
+
+		ImGui::Text("Draws: %u  GL calls: %u", frameStats.drawCalls, frameStats.glCalls);
+		ImGui::Text("Uniform lookups: %u  Uniform buffer uploads: %u", frameStats.uniformLookups, frameStats.uniformBufferUploads);
+		ImGui::Text("Allocations: %lu", frameStats.allocations.load());
+		ImGui::Text("Instances: %u drawn, %u culled", frameStats.instances, frameStats.culledInstances);
+		ImGui::Text("Draw items: %u  Binds: %u program, %u vertex array, %u texture", frameStats.drawItems,
+			frameStats.programBinds, frameStats.vertexArrayBinds, frameStats.textureBinds);
+		ImGui::Text("GL state calls: %u issued, %u filtered", frameStats.glStateIssued, frameStats.glStateFiltered);
+		if (effect)
+		{
+			ImGui::Text("Offscreen effect: %.0f renders/s, target %dx%d, shaded %dx%d", effect->rendersPerSecond(),
+				effect->targetWidth(), effect->targetHeight(), effect->renderedWidth(), effect->renderedHeight());
+		}
+
+		ImGui::Separator();
+		for (int kind = 0; kind < GPU_RESOURCE_KINDS; kind++)
+		{
+			ImGui::Text("%s: %ld live, %.2f MB", gpuResourceName(kind), gpuResources.live[kind],
+				gpuResources.bytes[kind] / (1024.0 * 1024.0));
+		}
+		ImGui::Text("GPU total: %.2f MB (peak %.2f MB)", total / (1024.0 * 1024.0), peakBytes / (1024.0 * 1024.0));
+		ImGui::Text("Created: %ld  Destroyed: %ld", gpuResources.created, gpuResources.destroyed);
+		ImGui::Text("Mesh arena: %zu pools, %.2f / %.2f MB", gpuArena.poolCount(),
+			gpuArena.usedBytes() / (1024.0 * 1024.0), gpuArena.capacityBytes() / (1024.0 * 1024.0));
+		ImGui::Text("Texture cache: %zu textures, %u decodes, %u compressed, %u path hits, %u content hits",
+			textureCache.size(), textureCache.decodes, textureCache.compressedLoads, textureCache.pathHits,
+			textureCache.contentHits);
+
+		ImGui::Separator();
+		// Rebuilds the planet every frame, live counts and bytes must not grow
+		ImGui::Checkbox("Soak test", &soakTest);
+		ImGui::SameLine();
+		ImGui::Checkbox("Memory", &memoryVisible);
+
+		ImGui::End();
+
+		if (!memoryVisible)
+			return;
+		if (memoryTime < 0.0 || now - memoryTime >= MEMORY_REFRESH_SECONDS)
+		{
+			memory = collectMemory();
+			memoryTime = now;
+		}
+		DrawMemory(memory);
+	}
+
+	// Subsystem totals against their budgets, each one opens to its assets
+	void DrawMemory(const MemoryReport& memory)
+	{
+		const double MB = 1024.0 * 1024.0;
+		ImGui::SetNextWindowPos(ImVec2(10, 330), ImGuiCond_FirstUseEver);
+		ImGui::SetNextWindowBgAlpha(0.6f);
+		ImGui::Begin("Memory", &memoryVisible, ImGuiWindowFlags_AlwaysAutoResize);
+
+		ImGui::Text("CPU: %.2f MB  GPU: %.2f MB  Heap: %.2f MB", memory.cpuBytes() / MB, memory.gpuBytes() / MB,
+			heapBytes() / MB);
+		if (ImGui::Button("Refresh"))
+			memoryTime = -1.0;
+		ImGui::SameLine();
+		if (ImGui::Button("Dump JSON"))
+		{
+			std::cout << memory.toJson();
+			if (!memory.writeJson("memory_report.json"))
+				std::cout << "ERROR: could not write memory_report.json" << std::endl;
+		}
+
+		for (const SubsystemMemory& subsystem : memory.subsystems())
+		{
+			ImGui::Separator();
+			if (subsystem.overBudget())
+				ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f), "Over budget, CPU %.2f MB GPU %.2f MB",
+					subsystem.budget->cpuBytes / MB, subsystem.budget->gpuBytes / MB);
+			bool open = ImGui::TreeNode(subsystem.name.c_str());
+			ImGui::SameLine();
+			ImGui::Text("%u, CPU %.2f MB, GPU %.2f MB", subsystem.count, subsystem.cpuBytes / MB, subsystem.gpuBytes / MB);
+			if (!open)
+				continue;
+			if (ImGui::BeginTable(subsystem.name.c_str(), 4))
+			{
+				ImGui::TableSetupColumn("Asset");
+				ImGui::TableSetupColumn("Count");
+				ImGui::TableSetupColumn("CPU KB");
+				ImGui::TableSetupColumn("GPU KB");
+				ImGui::TableHeadersRow();
+				for (const AssetMemory& asset : memory.assets)
+				{
+					if (asset.subsystem != subsystem.name)
+						continue;
+					ImGui::TableNextRow();
+					ImGui::TableNextColumn();
+					ImGui::Text("%s", asset.name.c_str());
+					ImGui::TableNextColumn();
+					ImGui::Text("%u", asset.count);
+					ImGui::TableNextColumn();
+					ImGui::Text("%.1f", asset.cpuBytes / 1024.0);
+					ImGui::TableNextColumn();
+					ImGui::Text("%.1f", asset.gpuBytes / 1024.0);
+				}
+				ImGui::EndTable();
+			}
+			ImGui::TreePop();
+		}
+
+		ImGui::End();
+	}
+
+public:
+	bool visible = false;
+	bool soakTest = false;
+	long long peakBytes = 0;
+	// Shown with the frame stats when set
+	const OffscreenEffect* effect = nullptr;
+	// The Memory window, closed on its own without hiding the stats
+	bool memoryVisible = true;
+
+private:
+	static constexpr double MEMORY_REFRESH_SECONDS = 1.0;
+
+	// Last report shown, negative memoryTime collects a new one on the next Draw
+	MemoryReport memory;
+	double memoryTime = -1.0;
+};
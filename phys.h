@@ -20,7 +20,7 @@ public:
 
 		colors = a_colors;
 
-		mesh = a_mesh;
+		mesh = std::move(a_mesh);
 		resolution = a_resolution;
 		localUp = a_localUp;
 
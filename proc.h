@@ -1,6 +1,7 @@
 #pragma once
 
 #include "mesh.h"
+#include "mesh_optimizer.h"
 #include "vec3.h"
 
 #include <stdio.h>
@@ -15,12 +16,13 @@ public:
 
 	TerrainFace() = default;
 
-	TerrainFace(Mesh a_mesh, int a_resolution, vec3 a_localUp, std::vector<float> a_colors)
+	TerrainFace(VertexFormat a_format, int a_resolution, vec3 a_localUp, std::vector<float> a_colors)
 	{
 
 		colors = a_colors;
 
-		mesh = a_mesh;
+		mesh.format = a_format;
+		mesh.storage = MeshStorage::Arena;
 		resolution = a_resolution;
 		localUp = a_localUp;
 
@@ -90,11 +92,43 @@ public:
 		}
 
 
-		mesh = Mesh(vertices, triangles);
+		// Elevations are indexed by grid position, so only triangles get reordered. The order only
+		// depends on the grid, rebuilds at the same resolution reuse the first one's
+		if (optimizedResolution != resolution)
+		{
+			optimizeReport = optimizeMesh(vertices, triangles, false);
+			optimizedTriangles = triangles;
+			optimizedResolution = resolution;
+		}
+		else
+		{
+			triangles = optimizedTriangles;
+		}
+
+		// Keep whichever vertex format and storage the face was created with
+		mesh = Mesh(std::move(vertices), std::move(triangles), mesh.format, mesh.storage);
 	}
 
+	TerrainFace(const TerrainFace&) = delete;
+	TerrainFace& operator=(const TerrainFace&) = delete;
+	TerrainFace(TerrainFace&&) = default;
+	TerrainFace& operator=(TerrainFace&&) = default;
 	~TerrainFace() {}
 
+	// Mesh plus the colors and elevations it was built from
+	AssetMemory memoryUsage() const
+	{
+		AssetMemory usage;
+		usage.subsystem = "Planet";
+		usage.name = "face (" + std::to_string((int)localUp.x()) + ", " + std::to_string((int)localUp.y()) + ", " +
+			std::to_string((int)localUp.z()) + ")";
+		usage.cpuBytes = mesh.cpuBytes() + vectorBytes(colors) + vectorBytes(elevations) +
+			vectorBytes(optimizedTriangles);
+		usage.gpuBytes = mesh.gpuBytes();
+		usage.count = 1;
+		return usage;
+	}
+
 public:
 	Mesh mesh;
 	int resolution;
@@ -103,6 +137,12 @@ public:
 	vec3 axisB;
 	std::vector<float> colors;
 	std::vector<vec3> elevations;
+	MeshOptimizerReport optimizeReport;
+
+private:
+	// Triangle order optimized for the grid at optimizedResolution
+	std::vector<GLuint> optimizedTriangles;
+	int optimizedResolution = 0;
 };
 
 
@@ -155,6 +195,11 @@ public:
 	~PerlinNoise() {
 	}
 
+	long long cpuBytes() const
+	{
+		return vectorBytes(randvec) + vectorBytes(perm_x) + vectorBytes(perm_y) + vectorBytes(perm_z);
+	}
+
 private:
 	std::vector<vec3> randvec;
 	std::vector<int> perm_x;
@@ -267,7 +312,7 @@ class Planet {
 public:
 	Planet(std::vector<TerrainFace> a_terrainfaces) 
 	{
-		terrainFaces = a_terrainfaces;
+		terrainFaces = std::move(a_terrainfaces);
 		// All faces have same color and res, just take first one
 		colors = ImVec4(terrainFaces[0].colors[0], terrainFaces[0].colors[1], terrainFaces[0].colors[2], 1.0f);
 		res = terrainFaces[0].resolution;
@@ -386,15 +431,9 @@ public:
 		}
 	}
 
-	void RenderUI(GLFWwindow* window)
+	// Called between beginUIFrame and endUIFrame, see overlay.h
+	void RenderUI()
 	{
-		glfwSwapInterval(1); // Enable vsync
-
-		// Start the Dear ImGui frame
-		ImGui_ImplOpenGL3_NewFrame();
-		ImGui_ImplGlfw_NewFrame();
-		ImGui::NewFrame();
-
 		ImGui::Begin("Sphere Explorer!");                          // Create a window
 
 		ImGui::Text("Change settings to observe real time changes");
@@ -430,17 +469,25 @@ public:
 		ImGui::Checkbox("Apply Gradient", &applyGradient);
 
 		ImGui::End();
+	}
 
-		// Rendering
-		ImGui::Render();
-		int display_w, display_h;
-		glfwGetFramebufferSize(window, &display_w, &display_h);
-		glViewport(0, 0, display_w, display_h);
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
-
-		glfwSwapBuffers(window);
+	// One entry per face, then the noise tables and the elevations not handed to a face yet
+	void reportMemory(MemoryReport& report) const
+	{
+		for (const TerrainFace& face : terrainFaces)
+			report.add(face.memoryUsage());
+
+		AssetMemory noise;
+		noise.subsystem = "Planet";
+		noise.name = "noise and elevations";
+		noise.cpuBytes = vectorBytes(terrainFaces) + noiseLayer.noise.cpuBytes() + vectorBytes(elevations);
+		report.add(noise);
 	}
 
+	Planet(const Planet&) = delete;
+	Planet& operator=(const Planet&) = delete;
+	Planet(Planet&&) = default;
+	Planet& operator=(Planet&&) = default;
 	~Planet() {};
 
 public:
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Packing helpers used to build compact vertex formats before upload
+
+// fp32 to IEEE half, round to nearest even, overflow goes to inf
+inline uint16_t floatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t floatExponent = (bits >> 23) & 0xff;
+	uint32_t mantissa = bits & 0x7fffff;
+	int exponent = static_cast<int>(floatExponent) - 127 + 15;
+
+	// Inf and NaN
+	if (floatExponent == 0xff)
+		return static_cast<uint16_t>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+	if (exponent >= 31)
+		return static_cast<uint16_t>(sign | 0x7c00);
+
+	// Half subnormals, anything smaller flushes to signed zero
+	if (exponent <= 0)
+	{
+		if (exponent < -10)
+			return static_cast<uint16_t>(sign);
+
+		mantissa |= 0x800000;
+		uint32_t shift = static_cast<uint32_t>(14 - exponent);
+		uint32_t half = mantissa >> shift;
+		uint32_t remainder = mantissa & ((1u << shift) - 1);
+		uint32_t midpoint = 1u << (shift - 1);
+		if (remainder > midpoint || (remainder == midpoint && (half & 1)))
+			half++;
+		return static_cast<uint16_t>(sign | half);
+	}
+
+	uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+	uint32_t remainder = mantissa & 0x1fff;
+	// A carry out of the mantissa correctly bumps the exponent
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1)))
+		half++;
+	return static_cast<uint16_t>(half);
+}
+
+// [-1, 1] to snorm16, matches the GLES3 conversion c / 32767
+inline int16_t floatToSnorm16(float value)
+{
+	if (value > 1.0f) value = 1.0f;
+	if (value < -1.0f) value = -1.0f;
+	return static_cast<int16_t>(std::lround(value * 32767.0f));
+}
+
+// [0, 1] to unorm8
+inline uint8_t floatToUnorm8(float value)
+{
+	if (value > 1.0f) value = 1.0f;
+	if (value < 0.0f) value = 0.0f;
+	return static_cast<uint8_t>(std::lround(value * 255.0f));
+}
+
+// Tangent frame as one unit quaternion, the rotation taking x to the tangent and z to
+// the normal. tangent[3] is the bitangent sign, bitangent = cross(normal, tangent) * sign,
+// carried by the sign of w so w is kept clear of 0, where snorm16 would lose it.
+// Decoded by qtangentDecode in the vertex shaders
+inline void encodeQTangent(const float normal[3], const float tangent[4], float out[4])
+{
+	float n[3] = { normal[0], normal[1], normal[2] };
+	float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+	if (length == 0.0f)
+	{
+		n[0] = 0.0f;
+		n[1] = 0.0f;
+		n[2] = 1.0f;
+		length = 1.0f;
+	}
+	for (int c = 0; c < 3; c++)
+		n[c] /= length;
+
+	// Gram-Schmidt, any perpendicular will do when the tangent is missing or parallel
+	float t[3];
+	float d = n[0] * tangent[0] + n[1] * tangent[1] + n[2] * tangent[2];
+	for (int c = 0; c < 3; c++)
+		t[c] = tangent[c] - n[c] * d;
+	length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+	if (length < 1e-6f)
+	{
+		float axis[3] = { std::fabs(n[0]) < 0.9f ? 1.0f : 0.0f, std::fabs(n[0]) < 0.9f ? 0.0f : 1.0f, 0.0f };
+		d = n[0] * axis[0] + n[1] * axis[1];
+		for (int c = 0; c < 3; c++)
+			t[c] = axis[c] - n[c] * d;
+		length = std::sqrt(t[0] * t[0] + t[1] * t[1] + t[2] * t[2]);
+	}
+	for (int c = 0; c < 3; c++)
+		t[c] /= length;
+
+	float b[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+
+	// Rotation matrix with columns t, b, n to quaternion
+	float m00 = t[0], m10 = t[1], m20 = t[2];
+	float m01 = b[0], m11 = b[1], m21 = b[2];
+	float m02 = n[0], m12 = n[1], m22 = n[2];
+	float x, y, z, w;
+	float trace = m00 + m11 + m22;
+	if (trace > 0.0f)
+	{
+		float s = std::sqrt(trace + 1.0f) * 2.0f;
+		w = 0.25f * s;
+		x = (m21 - m12) / s;
+		y = (m02 - m20) / s;
+		z = (m10 - m01) / s;
+	}
+	else if (m00 > m11 && m00 > m22)
+	{
+		float s = std::sqrt(1.0f + m00 - m11 - m22) * 2.0f;
+		w = (m21 - m12) / s;
+		x = 0.25f * s;
+		y = (m01 + m10) / s;
+		z = (m02 + m20) / s;
+	}
+	else if (m11 > m22)
+	{
+		float s = std::sqrt(1.0f + m11 - m00 - m22) * 2.0f;
+		w = (m02 - m20) / s;
+		x = (m01 + m10) / s;
+		y = 0.25f * s;
+		z = (m12 + m21) / s;
+	}
+	else
+	{
+		float s = std::sqrt(1.0f + m22 - m00 - m11) * 2.0f;
+		w = (m10 - m01) / s;
+		x = (m02 + m20) / s;
+		y = (m12 + m21) / s;
+		z = 0.25f * s;
+	}
+
+	// q and -q are the same rotation, keep w positive and at least one snorm16 step
+	float q[4] = { x, y, z, w };
+	length = std::sqrt(x * x + y * y + z * z + w * w);
+	float sign = w < 0.0f ? -1.0f : 1.0f;
+	for (int c = 0; c < 4; c++)
+		q[c] *= sign / length;
+	const float bias = 1.0f / 32767.0f;
+	if (q[3] < bias)
+	{
+		float scale = std::sqrt(1.0f - bias * bias) / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2]);
+		for (int c = 0; c < 3; c++)
+			q[c] *= scale;
+		q[3] = bias;
+	}
+
+	float handedness = tangent[3] < 0.0f ? -1.0f : 1.0f;
+	for (int c = 0; c < 4; c++)
+		out[c] = q[c] * handedness;
+}
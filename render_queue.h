@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "gl_state.h"
+#include "instancing.h"
+#include "shader_program.h"
+#include "stats.h"
+
+// Draws of one frame, submitted by each part of the scene in any order and issued
+// sorted by a 64 bit key: pass, program, material, vertex array, then depth.
+// Neighbours in that order share their state, binds go through glState which drops those
+// already current, and items set their own uniforms and issue the draw call.
+// Items point at submitter data, which has to outlive execute.
+
+// Issued in this order. Sky after the opaque geometry so depth rejects most of it,
+// Transparent last and back to front for blending
+enum class RenderPass {
+	Opaque,
+	Sky,
+	Transparent
+};
+
+// Texture bound on a unit of its own before an item draws, for textures shared by
+// several items that the draw does not bind itself, like a model's texture arrays
+struct UnitTexture {
+	GLenum unit = GL_TEXTURE0;
+	GLenum target = GL_TEXTURE_2D;
+	GLuint texture = 0;
+};
+
+const int MAX_UNIT_TEXTURES = 3;
+
+struct DrawItem;
+using DrawFunction = void (*)(const DrawItem& item);
+
+struct DrawItem {
+	RenderPass pass = RenderPass::Opaque;
+	GLuint program = 0;
+	// Groups items sharing textures, any id the submitter picks for them
+	GLuint material = 0;
+	// Bound by the queue, 0 when the draw binds its own
+	GLuint vertexArray = 0;
+	// Distance to the camera
+	float depth = 0.0f;
+	// Texture the queue binds on unit 0, 0 when the draw binds its own
+	GLenum textureTarget = GL_TEXTURE_2D;
+	GLuint texture = 0;
+	UnitTexture unitTextures[MAX_UNIT_TEXTURES];
+	int unitTextureCount = 0;
+	GLenum depthFunc = GL_LESS;
+	// Set from transform before the draw, when given
+	UniformMat4 model;
+	const InstanceTransform* transform = nullptr;
+	// Issues the draw with the state above bound, object, context and param belong to the submitter
+	DrawFunction draw = nullptr;
+	void* object = nullptr;
+	void* context = nullptr;
+	int param = 0;
+
+	// Filled by RenderQueue::submit
+	uint64_t key = 0;
+	uint32_t order = 0;
+};
+
+// Bits from the top: pass 4, program 8, material 16, vertex array 12, depth 24.
+// GL names are small integers, ids wider than their field only lose some grouping
+inline uint64_t renderSortKey(RenderPass pass, GLuint program, GLuint material, GLuint vertexArray, float depth,
+	float farPlane)
+{
+	const uint64_t depthMax = (1u << 24) - 1;
+	uint64_t depthBits = static_cast<uint64_t>(std::min(std::max(depth / farPlane, 0.0f), 1.0f) * depthMax);
+	if (pass == RenderPass::Transparent)
+		depthBits = depthMax - depthBits;
+	return static_cast<uint64_t>(pass) << 60 | static_cast<uint64_t>(program & 0xFF) << 52 |
+		static_cast<uint64_t>(material & 0xFFFF) << 36 | static_cast<uint64_t>(vertexArray & 0xFFF) << 24 | depthBits;
+}
+
+class RenderQueue {
+public:
+	// Depth is scaled by it into the key, the projection far plane
+	float farPlane = 100.0f;
+
+	void submit(const DrawItem& item)
+	{
+		items.push_back(item);
+		DrawItem& added = items.back();
+		added.key = renderSortKey(item.pass, item.program, item.material, item.vertexArray, item.depth, farPlane);
+		added.order = static_cast<uint32_t>(items.size() - 1);
+	}
+
+	// Sorts and issues every item submitted since the last call, then empties the queue.
+	// The depth function is back to GL_LESS on exit
+	void execute()
+	{
+		std::sort(items.begin(), items.end(), [](const DrawItem& a, const DrawItem& b) {
+			return a.key != b.key ? a.key < b.key : a.order < b.order;
+		});
+
+		const InstanceTransform* transform = nullptr;
+		for (size_t i = 0; i < items.size(); i++)
+		{
+			const DrawItem& item = items[i];
+			const DrawItem* previous = i ? &items[i - 1] : nullptr;
+
+			// glState drops whatever a previous draw left bound already
+			if (!previous || item.program != previous->program)
+			{
+				glState.useProgram(item.program);
+				transform = nullptr;
+				frameStats.programBinds++;
+			}
+			if (item.vertexArray)
+			{
+				if (!previous || item.vertexArray != previous->vertexArray)
+					frameStats.vertexArrayBinds++;
+				glState.bindVertexArray(item.vertexArray);
+			}
+			if (item.texture)
+			{
+				if (!previous || item.texture != previous->texture || item.textureTarget != previous->textureTarget)
+					frameStats.textureBinds++;
+				glState.bindTexture(GL_TEXTURE0, item.textureTarget, item.texture);
+			}
+			for (int t = 0; t < item.unitTextureCount; t++)
+			{
+				const UnitTexture& bound = item.unitTextures[t];
+				if (!previous || t >= previous->unitTextureCount || bound.texture != previous->unitTextures[t].texture)
+					frameStats.textureBinds++;
+				glState.bindTexture(bound.unit, bound.target, bound.texture);
+			}
+			glState.depthFunc(item.depthFunc);
+			if (item.transform && item.transform != transform)
+			{
+				glUniformMatrix4fv(item.model.location, 1, GL_FALSE, item.transform->m);
+				transform = item.transform;
+				frameStats.glCalls++;
+			}
+
+			item.draw(item);
+		}
+		frameStats.drawItems += static_cast<unsigned int>(items.size());
+		glState.depthFunc(GL_LESS);
+		items.clear();
+	}
+
+	size_t size() const { return items.size(); }
+
+private:
+	// Keeps its capacity between frames
+	std::vector<DrawItem> items;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+#include "stats.h"
+#include "uniform_buffers.h"
+
+// Linked program plus every active uniform, reflected once after link with glGetActiveUniform.
+// Draw code keeps typed handles resolved at setup, so setting a uniform each frame is one
+// glUniform call on a stored location, with no string building, lookups or hashing.
+// Handles of uniforms the shader does not use, or optimized out, hold -1 and are ignored by GL.
+// Camera and Lights blocks are attached to their binding points here too, see uniform_buffers.h.
+
+struct UniformFloat {
+	static constexpr GLenum TYPE = GL_FLOAT;
+	GLint location = -1;
+	void set(GLfloat value) const { glUniform1f(location, value); }
+};
+
+// Also bools and samplers, which are set as ints
+struct UniformInt {
+	static constexpr GLenum TYPE = GL_INT;
+	GLint location = -1;
+	void set(GLint value) const { glUniform1i(location, value); }
+};
+
+struct UniformVec2 {
+	static constexpr GLenum TYPE = GL_FLOAT_VEC2;
+	GLint location = -1;
+	void set(GLfloat x, GLfloat y) const { glUniform2f(location, x, y); }
+};
+
+struct UniformVec3 {
+	static constexpr GLenum TYPE = GL_FLOAT_VEC3;
+	GLint location = -1;
+	void set(GLfloat x, GLfloat y, GLfloat z) const { glUniform3f(location, x, y, z); }
+	void set(const GLfloat* values) const { glUniform3fv(location, 1, values); }
+};
+
+struct UniformVec4 {
+	static constexpr GLenum TYPE = GL_FLOAT_VEC4;
+	GLint location = -1;
+	void set(const GLfloat* values) const { glUniform4fv(location, 1, values); }
+};
+
+// Takes mat4::toFloatVector order
+struct UniformMat4 {
+	static constexpr GLenum TYPE = GL_FLOAT_MAT4;
+	GLint location = -1;
+	void set(const std::vector<float>& values) const { glUniformMatrix4fv(location, 1, GL_FALSE, values.data()); }
+};
+
+class ShaderProgram {
+public:
+	ShaderProgram() = default;
+
+	// Takes ownership of a linked program, 0 stays empty
+	explicit ShaderProgram(GLuint id) : program(id)
+	{
+		reflect();
+		if (program.get())
+			bindUniformBlocks(program);
+	}
+
+	GLuint get() const { return program.get(); }
+	operator GLuint() const { return program.get(); }
+
+	// Setup time only. Array elements are named as GLSL does, "pointLights[2].position"
+	// or "weights[3]", the bare name of an array is its first element
+	template <typename Handle>
+	Handle uniform(const std::string& name) const
+	{
+		Handle handle;
+		auto it = uniforms.find(name);
+		if (it == uniforms.end())
+			return handle;
+		if (!compatible(Handle::TYPE, it->second.type))
+		{
+			std::cout << "ERROR: uniform " << name << " of program " << get() << " is declared with GL type 0x"
+				<< std::hex << it->second.type << std::dec << std::endl;
+			return handle;
+		}
+		handle.location = it->second.location;
+		return handle;
+	}
+
+	size_t uniformCount() const { return uniforms.size(); }
+
+private:
+	struct UniformInfo {
+		GLint location = -1;
+		GLenum type = 0;
+	};
+
+	GLProgram program;
+	std::unordered_map<std::string, UniformInfo> uniforms;
+
+	void reflect()
+	{
+		if (!program.get())
+			return;
+
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		std::vector<char> buffer(static_cast<size_t>(std::max(maxLength, 1)));
+
+		for (GLint i = 0; i < count; i++)
+		{
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()), &length, &size, &type,
+				buffer.data());
+			std::string name(buffer.data(), static_cast<size_t>(length));
+
+			// Arrays of basic types are reported once as "name[0]", with size elements
+			std::string base = name;
+			if (size > 1 || (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0))
+				base = name.substr(0, name.rfind('['));
+
+			for (GLint element = 0; element < size; element++)
+			{
+				std::string elementName = base == name ? name : base + "[" + std::to_string(element) + "]";
+				UniformInfo info;
+				info.location = glGetUniformLocation(program, elementName.c_str());
+				info.type = type;
+				frameStats.uniformLookups++;
+				// Members of uniform blocks have no location, they are set through their buffer
+				if (info.location < 0)
+					continue;
+				uniforms[elementName] = info;
+				if (element == 0 && base != name)
+					uniforms[base] = info;
+			}
+		}
+	}
+
+	static bool isSampler(GLenum type)
+	{
+		switch (type)
+		{
+		case GL_SAMPLER_2D:
+		case GL_SAMPLER_3D:
+		case GL_SAMPLER_CUBE:
+		case GL_SAMPLER_2D_SHADOW:
+		case GL_SAMPLER_2D_ARRAY:
+		case GL_SAMPLER_2D_ARRAY_SHADOW:
+		case GL_SAMPLER_CUBE_SHADOW:
+		case GL_INT_SAMPLER_2D:
+		case GL_INT_SAMPLER_3D:
+		case GL_INT_SAMPLER_CUBE:
+		case GL_INT_SAMPLER_2D_ARRAY:
+		case GL_UNSIGNED_INT_SAMPLER_2D:
+		case GL_UNSIGNED_INT_SAMPLER_3D:
+		case GL_UNSIGNED_INT_SAMPLER_CUBE:
+		case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	static bool compatible(GLenum handleType, GLenum type)
+	{
+		return handleType == type || (handleType == GL_INT && (type == GL_BOOL || isSampler(type)));
+	}
+};
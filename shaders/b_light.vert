@@ -2,8 +2,13 @@
 
 layout(location = 0) in vec3 position;
 
-uniform mat4 view;
-uniform mat4 proj;
+// See uniform_buffers.h
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
 uniform float pointSize;
 
 void main()
@@ -0,0 +1,14 @@
+#version 300 es
+
+precision mediump float;
+
+// Fractal rendered offscreen by shader_2.frag, read back at the same screen position
+uniform sampler2D effect;
+uniform vec2 framebufferSize;
+
+out vec4 FragColor;
+
+void main()
+{
+	FragColor = texture(effect, gl_FragCoord.xy / framebufferSize);
+}
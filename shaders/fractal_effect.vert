@@ -0,0 +1,8 @@
+#version 300 es
+
+// One triangle covering the whole target, no vertex buffer needed
+void main()
+{
+	vec2 corner = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -6,7 +6,13 @@ in vec3 v_normal;
 in vec3 fragPos;
 in vec3 initialPos;
 
-uniform vec3 viewPos;
+// See uniform_buffers.h. highp to match planet_shader.vert
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
 uniform int applyGradient;
 
 out vec4 FragColor;
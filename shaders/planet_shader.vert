@@ -2,23 +2,51 @@
 
 layout (location = 0) in vec4 a_vertex; // vertex position 
 layout (location = 1) in vec3 a_colors; // vertex colors
-layout (location = 3) in vec3 a_normal; // Normals Coordinates
+layout (location = 3) in vec4 a_normal; // Normals Coordinates, QTangent in compact formats
+
+// See uniform_buffers.h. Explicit highp, it must match the declaration in
+// planet_shader.frag where floats are mediump
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
 
-uniform mat4 vp;
 uniform mat4 model;
 
+// Set by Mesh::Draw for compact vertex formats
+uniform bool quantized;
+uniform vec3 posScale;
+uniform vec3 posOffset;
+
 out vec3 v_normal;
 out vec3 v_colors;
 out vec3 fragPos;
 out vec3 initialPos;
 
+// Normal part of the QTangent decode in shader.vert, the z column of the rotation
+vec3 qtangentNormal(vec4 q)
+{
+	q = normalize(q);
+	return vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+}
+
 void main()
 {
 	v_colors = a_colors;
 
-	v_normal = mat3(transpose(inverse(model))) * a_normal;
+	vec4 vertex = a_vertex;
+	vec3 normal = a_normal.xyz;
+	if (quantized)
+	{
+		vertex = vec4(a_vertex.xyz * posScale + posOffset, 1.0);
+		normal = qtangentNormal(a_normal);
+	}
+
+	v_normal = mat3(transpose(inverse(model))) * normal;
 
-	initialPos = vec3(a_vertex);
-	fragPos = vec3(a_vertex * model);
+	initialPos = vec3(vertex);
+	fragPos = vec3(vertex * model);
 	gl_Position = vec4(fragPos, 1.0) * vp;
 }
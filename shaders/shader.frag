@@ -1,17 +1,17 @@
 #version 300 es
 precision mediump float;
+precision mediump sampler2DArray;
 
 #define NR_POINT_LIGHTS 8
 
+// Scalars fill the std140 padding after each vec3, mirrored by PointLightBlock
 struct PointLight {
     vec3 position;
-    
     float constant;
-    float linear;
-    float quadratic;
-	
     vec3 ambient;
+    float linear;
     vec3 diffuse;
+    float quadratic;
     vec3 specular;
 };
 
@@ -21,16 +21,40 @@ struct Material {
 }; 
 
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo);
+vec4 materialTexture(sampler2D tex, sampler2DArray layers, vec2 uv);
 
 in vec3 v_colors;
 in vec2 v_texcoord;
 in vec3 v_normal;
+in vec4 v_tangent;
 in vec3 fragPos;
 
 uniform Material material;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform vec3 viewPos;
+// Bound by Mesh::Draw from texture_normal and texture_height material textures
+uniform sampler2D texture_normal1;
+uniform sampler2D texture_height1;
+uniform bool normalMapped;
+uniform bool heightMapped;
+// Texture arrays bound by Model with textureArrays, one layer per material
+uniform sampler2DArray layers_diffuse;
+uniform sampler2DArray layers_normal;
+uniform sampler2DArray layers_height;
+uniform bool layered;
+uniform float materialLayer;
+
+// See uniform_buffers.h. highp as in shader.vert, the block is declared by both stages
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
+
+// Static lights, uploaded again only when one of them changes
+layout(std140) uniform Lights {
+    PointLight pointLights[NR_POINT_LIGHTS];
+};
 
 out vec4 FragColor;
 
@@ -38,17 +62,41 @@ void main()
 {
     vec3 norm = normalize(v_normal);
     vec3 viewDir = normalize(viewPos - fragPos);
+    vec2 uv = v_texcoord;
+
+    if (normalMapped || heightMapped)
+    {
+        vec3 tangent = normalize(v_tangent.xyz - norm * dot(norm, v_tangent.xyz));
+        mat3 tbn = mat3(tangent, cross(norm, tangent) * v_tangent.w, norm);
+
+        // Single step parallax offset, enough for the shallow relief of props
+        if (heightMapped)
+        {
+            vec3 viewTangent = transpose(tbn) * viewDir;
+            float height = materialTexture(texture_height1, layers_height, uv).r;
+            uv -= viewTangent.xy / max(viewTangent.z, 0.25) * (height * 0.04 - 0.02);
+        }
+        if (normalMapped)
+            norm = normalize(tbn * (materialTexture(texture_normal1, layers_normal, uv).xyz * 2.0 - 1.0));
+    }
 
+    vec3 albedo = vec3(materialTexture(material.tex, layers_diffuse, uv));
     vec3 finalColor = vec3(0.0);
 
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        finalColor.xyz += CalcPointLight(pointLights[i], norm, fragPos, viewDir);
+        finalColor.xyz += CalcPointLight(pointLights[i], norm, fragPos, viewDir, albedo);
     
     FragColor = vec4(finalColor, 1.0) * vec4(v_colors, 1.0);
 }
 
+// Own texture of the mesh, or its material layer in the array of that map
+vec4 materialTexture(sampler2D tex, sampler2DArray layers, vec2 uv)
+{
+    return layered ? texture(layers, vec3(uv, materialLayer)) : texture(tex, uv);
+}
+
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -60,9 +108,9 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.tex, v_texcoord));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.tex, v_texcoord));
-    vec3 specular = light.specular * spec * vec3(texture(material.tex, v_texcoord));
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * albedo;
     ambient *= attenuation;
     diffuse *= attenuation;
     specular *= attenuation;
@@ -3,21 +3,61 @@
 layout (location = 0) in vec4 a_vertex; // vertex position 
 layout (location = 1) in vec3 a_colors; // vertex colors
 layout (location = 2) in vec2 a_texcoord; // texture coordinates
-layout (location = 3) in vec3 a_normal; // Normals Coordinates
+layout (location = 3) in vec4 a_normal; // Normals Coordinates, QTangent in compact formats
+layout (location = 4) in mat4 a_instanceModel; // Per instance model matrix, locations 4 to 7
+layout (location = 8) in vec4 a_tangent; // Tangent and bitangent sign, float vertices only
+
+// See uniform_buffers.h. Explicit highp, floats in shader.frag are mediump and
+// the declaration in shader.frag must match this one
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
 
-uniform mat4 vp;
 uniform mat4 model;
+// Set by Mesh::DrawInstanced, a_instanceModel then replaces model
+uniform bool instanced;
+
+// Set by Mesh::Draw for compact vertex formats
+uniform bool quantized;
+uniform vec3 posScale;
+uniform vec3 posOffset;
 
 out vec2 v_texcoord;
 out vec3 v_colors;
 out vec3 v_normal;
+out vec4 v_tangent;
 out vec3 fragPos;
 
+// Inverse of encodeQTangent in quantize.h, the x and z columns of the rotation,
+// w < 0 marks a mirrored bitangent
+void qtangentDecode(vec4 q, out vec3 normal, out vec4 tangent)
+{
+	q = normalize(q);
+	normal = vec3(2.0 * (q.x * q.z + q.w * q.y), 2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+	tangent.xyz = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+	tangent.w = q.w < 0.0 ? -1.0 : 1.0;
+}
+
 void main()
 {
 	v_colors = a_colors;
 	v_texcoord = a_texcoord;
-	v_normal = mat3(transpose(inverse(model))) * a_normal;
-	fragPos = vec3(a_vertex * model);
+	vec4 vertex = a_vertex;
+	vec3 normal = a_normal.xyz;
+	vec4 tangent = a_tangent;
+	if (quantized)
+	{
+		vertex = vec4(a_vertex.xyz * posScale + posOffset, 1.0);
+		qtangentDecode(a_normal, normal, tangent);
+	}
+
+	mat4 world = instanced ? a_instanceModel : model;
+	v_normal = mat3(transpose(inverse(world))) * normal;
+	// Same convention as the normal, exact for rotations and uniform scale
+	v_tangent = vec4(mat3(world) * tangent.xyz, tangent.w);
+	fragPos = vec3(vertex * world);
 	gl_Position = vec4(fragPos, 1.0) * vp;
 }
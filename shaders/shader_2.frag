@@ -3,6 +3,8 @@
 precision mediump float;
 
 uniform float time;
+// Size of the offscreen target in pixels
+uniform vec2 resolution;
 
 out vec4 FragColor;
 
@@ -19,7 +21,7 @@ vec3 palette( float t )
 //From excellent tutorial from kishimisu youtube channel
 void main()
 {
-	vec2 uv = ( gl_FragCoord.xy * 2.0 - vec2(800.0, 600.0) ) / 600.0;
+	vec2 uv = ( gl_FragCoord.xy * 2.0 - resolution ) / resolution.y;
 	vec2 uv0 = uv;
 
 	vec3 finalColor = vec3(0.0);
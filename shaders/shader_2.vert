@@ -1,9 +1,15 @@
 #version 300 es
 layout (location = 0) in vec4 b_vertex; // vertex position 
 
-uniform mat4 mvp;
+// See uniform_buffers.h
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
 
 void main()
 {
-	gl_Position = b_vertex * mvp;
+	gl_Position = b_vertex * vp;
 }
\ No newline at end of file
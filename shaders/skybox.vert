@@ -4,7 +4,13 @@ layout(location = 0) in vec3 c_vertex; // Vertex position
 
 out vec3 TexCoords;
 
-uniform mat4 vp;
+// See uniform_buffers.h
+layout(std140) uniform Camera {
+    highp mat4 vp;
+    highp mat4 view;
+    highp mat4 proj;
+    highp vec3 viewPos;
+};
 
 void main()
 {
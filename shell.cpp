@@ -3,6 +3,7 @@
 #include <GLFW/glfw3.h>
 #include <emscripten.h>
 #include <emscripten/html5.h>
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <sstream>
@@ -15,16 +16,47 @@
 #include "model.h"
 #include "proc.h"
 #include "phys.h"
+#include "stats.h"
+#include "gl_resource.h"
+#include "texture_cache.h"
+#include "overlay.h"
+#include "shader_program.h"
+#include "uniform_buffers.h"
+#include "render_queue.h"
+#include "offscreen_effect.h"
 
 #include "./assets/vertices.h"
 
 #define CANVAS_WIDTH 800
 #define CANVAS_HEIGHT 600
 
+#ifdef FRAME_STATS
+#include <new>
+#include <cstdlib>
+
+// Count every heap allocation so per frame stats can show allocation churn
+void* operator new(std::size_t size)
+{
+    frameStats.allocations++;
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+#endif
+
 void loop();
 void processInput(GLFWwindow* window, double deltaTime);
 void processMouse(GLFWwindow* window, double xposIn, double yposIn);
-unsigned int loadCubeMap(std::vector<std::string> faces);
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 
 
@@ -153,16 +185,65 @@ GLfloat pointSize = 150.0f;
 GLfloat pointColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
 
 
-GLuint quadProgram = 0;
-GLuint planetProgram = 0;
-GLuint fractalProgram = 0;
-GLuint b_lightProgram = 0;
-GLuint skyboxProgram = 0;
-unsigned int skyboxVAO, skyboxVBO;
-unsigned int quadVAO, quadVBO, quadEBO;
-unsigned int fractVAO, fractVBO, fractEBO;
-unsigned int b_lightVAO, b_lightVBO;
+ShaderProgram quadProgram;
+ShaderProgram planetProgram;
+ShaderProgram fractalProgram;
+ShaderProgram fractalCompositeProgram;
+ShaderProgram b_lightProgram;
+ShaderProgram skyboxProgram;
+
+// Uniform handles of the programs above, resolved once after link.
+// Camera and lights come from the uniform buffers below
+struct QuadUniforms {
+    UniformFloat shininess;
+    UniformMat4 model;
+    UniformInt instanced;
+} quadUniforms;
+
+struct PlanetUniforms {
+    UniformMat4 model;
+    UniformInt applyGradient;
+} planetUniforms;
+
+struct FractalUniforms {
+    UniformFloat time;
+    UniformVec2 resolution;
+    // Of fractalCompositeProgram
+    UniformVec2 framebufferSize;
+} fractalUniforms;
+
+struct LightUniforms {
+    UniformFloat pointSize;
+    UniformVec4 pointColor;
+} lightUniforms;
+
+UniformBuffer<CameraBlock> cameraBuffer;
+UniformBuffer<LightsBlock> lightsBuffer;
+
+// Draws of the frame, and the transforms its items point at until it is executed
+RenderQueue renderQueue;
+InstanceTransform backpackTransform;
+InstanceTransform planetTransform;
+GLVertexArray skyboxVAO;
+GLBuffer skyboxVBO;
+GLVertexArray quadVAO;
+GLBuffer quadVBO, quadEBO;
+// Museum floor, one instance of the quad per tile
+StaticInstances floorTiles;
+GLVertexArray fractVAO;
+GLBuffer fractVBO, fractEBO;
+// Target of the fractal, and the box of the quad showing it, b_vertices at the origin
+OffscreenEffect fractalEffect;
+const InstanceTransform fractalTransform = instanceTransform(mat4());
+const float fractalBoundsMin[3] = { -2.0f, -2.0f, -1.0f };
+const float fractalBoundsMax[3] = { 2.0f, 2.0f, -1.0f };
+// Size of the default framebuffer, read again every frame
+int framebufferWidth = CANVAS_WIDTH;
+int framebufferHeight = CANVAS_HEIGHT;
+GLVertexArray b_lightVAO;
+GLBuffer b_lightVBO;
 GLFWwindow* window;
+DebugOverlay overlay;
 
 // Camera Set up
 Camera camera;
@@ -176,14 +257,50 @@ bool rightMouseButtonPressed = false;
 // Process Time
 double deltaTime = 0;
 double lastTime = 0;
+double lastStatsPrint = 0;
 
 // Textures init
-unsigned int tex;
-unsigned int cubemapTexture;
+SharedTexture tex;
+SharedTexture cubemapTexture;
 
 Model model1;
+// Backpacks standing beyond the floor, drawn instanced
+std::vector<InstanceTransform> backpackField;
 Planet planet;
 
+// Limits per subsystem, warned about once the model is loaded and shown in the overlay.
+// CPU then GPU bytes, 0 for none
+std::vector<MemoryBudget> memoryBudgets = {
+    { "Models", 64ll << 20, 64ll << 20 },
+    { "Textures", 1ll << 20, 96ll << 20 },
+    { "Cubemaps", 1ll << 20, 32ll << 20 },
+    { "Planet", 16ll << 20, 16ll << 20 },
+};
+
+MemoryReport collectMemory()
+{
+    MemoryReport report;
+    report.budgets = memoryBudgets;
+    report.add(model1.memoryUsage());
+    planet.reportMemory(report);
+    textureCache.reportMemory(report);
+
+    AssetMemory arenaSlack;
+    arenaSlack.subsystem = "Mesh arena";
+    arenaSlack.name = "unused pool space";
+    arenaSlack.gpuBytes = gpuArena.capacityBytes() - gpuArena.usedBytes();
+    arenaSlack.count = static_cast<unsigned int>(gpuArena.poolCount());
+    report.add(arenaSlack);
+
+    // Whatever gpuResources counts beyond the assets, scene buffers, vertex arrays and programs
+    AssetMemory scene;
+    scene.subsystem = "Scene";
+    scene.name = "buffers, vertex arrays and programs";
+    scene.gpuBytes = std::max(0ll, gpuResources.totalBytes() - report.gpuBytes());
+    report.add(scene);
+    return report;
+}
+
 int main()
 {
     if (!glfwInit())
@@ -207,43 +324,24 @@ int main()
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
 
     // QUAD PROG, starting with textures
-    quadProgram = createProgram("/shaders/shader.vert", "/shaders/shader.frag");
-
-
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_2D, tex);
-    // set the texture wrapping/filtering options (on the currently bound texture object)
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load("/assets/marble-texture.jpg", &width, &height, &nrChannels, 0);
-
-    stbi_set_flip_vertically_on_load(true); 
-    if (data) {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-    }
-    else {
-        std::cout << "Failed to load texture file" << std::endl;
-    }
+    quadProgram = ShaderProgram(createProgram("/shaders/shader.vert", "/shaders/shader.frag"));
+    quadUniforms.shininess = quadProgram.uniform<UniformFloat>("material.shininess");
+    quadUniforms.model = quadProgram.uniform<UniformMat4>("model");
+    quadUniforms.instanced = quadProgram.uniform<UniformInt>("instanced");
 
-    stbi_image_free(data);
 
-    // Create Buffers for Quad Program
-    glGenVertexArrays(1, &quadVAO);
-    glGenBuffers(1, &quadVBO);
-    glGenBuffers(1, &quadEBO);
+    // The marble is the only texture loaded unflipped
+    tex = textureCache.load("/assets/marble-texture.jpg", false, true);
 
-    glBindVertexArray(quadVAO);
+    // Create Buffers for Quad Program
+    quadVAO = createGLVertexArray();
+    quadVBO = createGLBuffer();
+    quadEBO = createGLBuffer();
 
-    glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glState.bindVertexArray(quadVAO);
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    uploadBuffer(quadVBO, GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    uploadBuffer(quadEBO, GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
 
     // Position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)0);
@@ -258,35 +356,86 @@ int main()
     glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 11 * sizeof(float), (void*)(8 * sizeof(float)));
 	glEnableVertexAttribArray(3);
 
-    // Activate shaders before sending texture uniform
-    glUseProgram(quadProgram);
-    glUniform1i(glGetUniformLocation(quadProgram, "material.tex"), 0);
+    // 8 x 8 tiles of 4 units around the origin, laid flat
+    std::vector<InstanceTransform> tiles;
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            mat4 tile = translate(mat4(), vec3(-12 + 4 * i, -2, -12 + 4 * j));
+            tile = pitch(tile, -90);
+            tile = scale(tile, 4);
+            tiles.push_back(instanceTransform(tile));
+        }
+    }
+    floorTiles.create(tiles, quadVAO);
 
-	char* path = (char*)"/assets/backpack/backpack.obj";
-    model1 = Model(path);
+    // Activate shaders before sending texture uniform
+    glState.useProgram(quadProgram);
+    quadProgram.uniform<UniformInt>("material.tex").set(0);
+    quadUniforms.shininess.set(32.0f);
+    assignTextureArrayUnits(quadProgram);
+
+	// Prefer the baked backpack when it was built with tools/model_baker, it loads without assimp
+	char* path = (char*)"/assets/backpack/backpack.wmdl";
+	if (FILE* baked = fopen(path, "rb"))
+		fclose(baked);
+	else
+		path = (char*)"/assets/backpack/backpack.obj";
+    // 16-bit positions within the model bounds are precise enough at less than half the size,
+    // the backpack is never edited so its CPU copy can go once uploaded
+    ModelOptions modelOptions;
+    modelOptions.vertexFormat = VertexFormat::Snorm16;
+    modelOptions.keepCpuData = false;
+    modelOptions.lodLevels = 3;
+    modelOptions.mergeByMaterial = true;
+    modelOptions.textureArrays = true;
+    // Streams in over the first frames, loop() drives it through pollLoad
+    model1.loadAsync(path, modelOptions, [](Model& model) {
+        std::cout << "First mesh drawable after " << model.firstMeshMilliseconds << " ms, fully loaded after "
+            << model.loadMilliseconds << " ms" << std::endl;
+        collectMemory().checkBudgets();
+    });
+
+    for (int i = 0; i < 16; i++)
+    {
+        for (int j = 0; j < 16; j++)
+        {
+            mat4 transform = translate(mat4(), vec3(-30.0 + 4.0 * i, -1.5, -20.0 - 4.0 * j));
+            transform = yaw(transform, 180 + 23 * (i * 16 + j));
+            transform = scale(transform, 0.4);
+            backpackField.push_back(instanceTransform(transform));
+        }
+    }
 
 
     // Unbind VAO
-    glBindVertexArray(0);
-    glUseProgram(0);
+    glState.bindVertexArray(0);
+    glState.useProgram(0);
 
     // Planet Program
-	planetProgram = createProgram("/shaders/planet_shader.vert", "/shaders/planet_shader.frag");
+	planetProgram = ShaderProgram(createProgram("/shaders/planet_shader.vert", "/shaders/planet_shader.frag"));
+    planetUniforms.model = planetProgram.uniform<UniformMat4>("model");
+    planetUniforms.applyGradient = planetProgram.uniform<UniformInt>("applyGradient");
 
-    glUseProgram(planetProgram);
+    glState.useProgram(planetProgram);
     std::vector<TerrainFace> terrainFaces;
     int resolution = 12;
     std::vector<float> color{ 0.7, 0.3, 0.4 };
-    Mesh sharedMesh;
     // up, down then left, right then forward, back
     vec3 directions[6] = { vec3(0.0, 1.0, 0.0), vec3(0.0, -1.0, 0.0), 
         vec3(1.0, 0.0, 0.0), vec3(-1.0, 0.0, 0.0), 
         vec3(0.0, 0.0, 1.0), vec3(0.0, 0.0, -1.0) };
     for (int i = 0; i < 6; i++)
     {
-        terrainFaces.push_back(TerrainFace(sharedMesh, resolution, directions[i], color));
+        terrainFaces.emplace_back(VertexFormat::Snorm16, resolution, directions[i], color);
     }
-    planet = Planet(terrainFaces);
+    MeshOptimizerReport planetReport;
+    for (auto& face : terrainFaces)
+        planetReport.add(face.optimizeReport);
+    planetReport.print("Planet terrain faces");
+
+    planet = Planet(std::move(terrainFaces));
     planet.setBaseGUI(window);
 
     /* Debug
@@ -302,35 +451,44 @@ int main()
     */
 
     // Fractal Program
-    fractalProgram = createProgram("/shaders/shader_2.vert", "/shaders/shader_2.frag");
+    // The effect renders offscreen at reduced size and rate, the quad then samples it
+    fractalProgram = ShaderProgram(createProgram("/shaders/fractal_effect.vert", "/shaders/shader_2.frag"));
+    fractalUniforms.time = fractalProgram.uniform<UniformFloat>("time");
+    fractalUniforms.resolution = fractalProgram.uniform<UniformVec2>("resolution");
+    fractalCompositeProgram = ShaderProgram(createProgram("/shaders/shader_2.vert", "/shaders/fractal_composite.frag"));
+    fractalUniforms.framebufferSize = fractalCompositeProgram.uniform<UniformVec2>("framebufferSize");
+    glState.useProgram(fractalCompositeProgram);
+    fractalCompositeProgram.uniform<UniformInt>("effect").set(0);
+    fractalEffect.scale = 0.5f;
+    fractalEffect.updateHz = 30.0;
+    overlay.effect = &fractalEffect;
     // Create Buffers for Fractal Program
-    glGenVertexArrays(1, &fractVAO);
-    glGenBuffers(1, &fractVBO);
-    glGenBuffers(1, &fractEBO);
-
-    glBindVertexArray(fractVAO);
+    fractVAO = createGLVertexArray();
+    fractVBO = createGLBuffer();
+    fractEBO = createGLBuffer();
 
-    glBindBuffer(GL_ARRAY_BUFFER, fractVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(b_vertices), b_vertices, GL_STATIC_DRAW);
+    glState.bindVertexArray(fractVAO);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, fractEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(b_indices), b_indices, GL_STATIC_DRAW);
+    uploadBuffer(fractVBO, GL_ARRAY_BUFFER, sizeof(b_vertices), b_vertices, GL_STATIC_DRAW);
+    uploadBuffer(fractEBO, GL_ELEMENT_ARRAY_BUFFER, sizeof(b_indices), b_indices, GL_STATIC_DRAW);
 
     // position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
 	// Unbind VAO
-    glBindVertexArray(0);
+    glState.bindVertexArray(0);
 
 
 	// BillBoard lights Progam
-    b_lightProgram = createProgram("/shaders/b_light.vert", "/shaders/b_light.frag");
+    b_lightProgram = ShaderProgram(createProgram("/shaders/b_light.vert", "/shaders/b_light.frag"));
+    lightUniforms.pointSize = b_lightProgram.uniform<UniformFloat>("pointSize");
+    lightUniforms.pointColor = b_lightProgram.uniform<UniformVec4>("pointColor");
     // Create Buffers for Fractal Program
-    glGenVertexArrays(1, &b_lightVAO);
-    glGenBuffers(1, &b_lightVBO);
+    b_lightVAO = createGLVertexArray();
+    b_lightVBO = createGLBuffer();
 
-    glBindVertexArray(b_lightVAO);
+    glState.bindVertexArray(b_lightVAO);
 
 	for (int i = 0; i < 7; i++)
     {
@@ -348,26 +506,35 @@ int main()
         pointPosition[5 + 3 * i] = static_cast<GLfloat>(round(nextLight.z()));
     }
 
-    glBindBuffer(GL_ARRAY_BUFFER, b_lightVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(pointPosition), pointPosition, GL_STATIC_DRAW);
+    uploadBuffer(b_lightVBO, GL_ARRAY_BUFFER, sizeof(pointPosition), pointPosition, GL_STATIC_DRAW);
+
+    // The lights never move, so the Lights block is written by the first frame only
+    LightsBlock lights;
+    for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+    {
+        lights.pointLights[i] = { { pointPosition[3 * i], pointPosition[1 + 3 * i], pointPosition[2 + 3 * i] }, 1.0f,
+            { 0.1f, 0.1f, 0.1f }, 0.09f, { 0.3f, 0.3f, 0.3f }, 0.0032f, { 0.5f, 0.5f, 0.5f }, 0.0f };
+    }
+    cameraBuffer.create(CAMERA_BINDING);
+    lightsBuffer.create(LIGHTS_BINDING);
+    lightsBuffer.set(lights);
 
     // position attribute
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
 	// Unbind VAO
-    glBindVertexArray(0);
+    glState.bindVertexArray(0);
 
 
 	// Skybox program
-    skyboxProgram = createProgram("/shaders/skybox.vert", "/shaders/skybox.frag");
-    glGenVertexArrays(1, &skyboxVAO);
-    glGenBuffers(1, &skyboxVBO);
+    skyboxProgram = ShaderProgram(createProgram("/shaders/skybox.vert", "/shaders/skybox.frag"));
+    skyboxVAO = createGLVertexArray();
+    skyboxVBO = createGLBuffer();
 
-    glBindVertexArray(skyboxVAO);
+    glState.bindVertexArray(skyboxVAO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    uploadBuffer(skyboxVBO, GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -381,19 +548,20 @@ int main()
 		"/assets/skybox/back.jpg"
 	};
 
-    cubemapTexture = loadCubeMap(faces);
+    // Decodes in parallel with everything above, uploaded over the first frames
+    cubemapTexture = textureCache.loadCubeMap(faces, true, true);
 
 	// Unbind VAO
-    glBindVertexArray(0);
+    glState.bindVertexArray(0);
 
-    glUseProgram(skyboxProgram);
-    glUniform1i(glGetUniformLocation(skyboxProgram, "skybox"), 0);
+    glState.useProgram(skyboxProgram);
+    skyboxProgram.uniform<UniformInt>("skybox").set(0);
 
 
-    glEnable(GL_BLEND);
-    glEnable(GL_DEPTH_TEST);
+    glState.setEnabled(GL_BLEND, true);
+    glState.setEnabled(GL_DEPTH_TEST, true);
 
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
 
     emscripten_set_main_loop(loop, 0, 1);
@@ -402,8 +570,49 @@ int main()
 }
 
 
+// Draws of the scene's render queue items, program, vertex array and texture already bound
+void drawFloor(const DrawItem&)
+{
+    quadUniforms.instanced.set(1);
+    floorTiles.draw(6, GL_UNSIGNED_SHORT);
+    quadUniforms.instanced.set(0);
+}
+
+// param is the gradient toggle of the planet GUI
+void drawPlanetFace(const DrawItem& item)
+{
+    planetUniforms.applyGradient.set(item.param);
+    static_cast<Mesh*>(item.object)->DrawBound(item.program);
+}
+
+void drawFractal(const DrawItem&)
+{
+    fractalUniforms.framebufferSize.set(static_cast<GLfloat>(framebufferWidth), static_cast<GLfloat>(framebufferHeight));
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+    frameStats.drawCalls++;
+}
+
+void drawSkybox(const DrawItem&)
+{
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    frameStats.drawCalls++;
+}
+
+void drawBillboards(const DrawItem&)
+{
+    lightUniforms.pointSize.set(pointSize);
+    lightUniforms.pointColor.set(pointColor);
+    glDrawArrays(GL_POINTS, 0, 8);
+    frameStats.drawCalls++;
+}
+
 void loop()
 {
+    frameStats.reset();
+
+    // Async loads take a few milliseconds of each frame until done
+    if (model1.pollLoad())
+        textureCache.pollLoads();
 
     if (rightMouseButtonPressed)
     {
@@ -424,187 +633,166 @@ void loop()
     mat4 view = camera.GetViewMatrix();
     mat4 proj = projection_mat(60, CANVAS_WIDTH, CANVAS_HEIGHT, 0.1, 100);
 	mat4 vp = proj * view;
+    std::vector<float> formattedVP = vp.toFloatVector();
+
+    // Camera block for every program, the lights only upload when they changed
+    CameraBlock cameraBlock;
+    std::copy(formattedVP.begin(), formattedVP.end(), cameraBlock.vp);
+    std::vector<float> formattedView = view.toFloatVector();
+    std::copy(formattedView.begin(), formattedView.end(), cameraBlock.view);
+    std::vector<float> formattedProj = proj.toFloatVector();
+    std::copy(formattedProj.begin(), formattedProj.end(), cameraBlock.proj);
+    cameraBlock.viewPos[0] = static_cast<float>(camera.Position.x());
+    cameraBlock.viewPos[1] = static_cast<float>(camera.Position.y());
+    cameraBlock.viewPos[2] = static_cast<float>(camera.Position.z());
+    cameraBlock.viewPos[3] = 1.0f;
+    cameraBuffer.set(cameraBlock);
+    cameraBuffer.upload();
+    lightsBuffer.upload();
+
+    Frustum frustum = Frustum::fromViewProjection(formattedVP);
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+    // Refreshes the fractal target when due, only where its quad lands on screen and
+    // nothing at all while the quad is out of view
+    bool fractalVisible = frustum.intersects(fractalTransform, fractalBoundsMin, fractalBoundsMax);
+    int fractalRect[4];
+    bool fractalBounded = screenRect(formattedVP, fractalTransform, fractalBoundsMin, fractalBoundsMax,
+        framebufferWidth, framebufferHeight, fractalRect);
+    if (!fractalVisible)
+        fractalEffect.skip(now);
+    else if (fractalEffect.begin(framebufferWidth, framebufferHeight, now, fractalBounded ? fractalRect : nullptr))
+    {
+        glState.useProgram(fractalProgram);
+        fractalUniforms.time.set(static_cast<GLfloat>(now));
+        fractalUniforms.resolution.set(static_cast<GLfloat>(fractalEffect.targetWidth()),
+            static_cast<GLfloat>(fractalEffect.targetHeight()));
+        glState.bindVertexArray(fractVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        frameStats.drawCalls++;
+        fractalEffect.end(framebufferWidth, framebufferHeight);
+    }
 
     glClearColor(0.1, 0.1, 0.2, 1);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
-    // Start Quad program
-    glUseProgram(quadProgram);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-
-    glBindVertexArray(quadVAO);
-
-    unsigned int shineLoc = glGetUniformLocation(quadProgram, "material.shininess");
-    glUniform1f(shineLoc, 32.0f);
-
-    mat4 vp1 = vp;
-    unsigned int vpLoc = glGetUniformLocation(quadProgram, "vp");
-    std::vector<float> formattedVP1 = vp1.toFloatVector();
-	glUniformMatrix4fv(vpLoc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedVP1.data()));
+    // Every part of the scene queues its draws, issued below sorted by state
+    DrawItem floor;
+    floor.program = quadProgram;
+    floor.material = tex;
+    floor.vertexArray = quadVAO;
+    floor.depth = static_cast<float>(camera.Position.length());
+    floor.texture = tex;
+    floor.draw = drawFloor;
+    renderQueue.submit(floor);
 
     mat4 model;
-	unsigned int modelLoc = glGetUniformLocation(quadProgram, "model");
+    model = translate(model, vec3(4.0, 0.0, -2.0));
+    model = yaw(model, 180);
+	model = scale(model, 0.4);
+    backpackTransform = instanceTransform(model);
+
+    // Screen space error picks the backpack LODs
+    LodSelector lodSelector;
+    lodSelector.distance = (camera.Position - vec3(4.0, 0.0, -2.0)).length();
+    lodSelector.scale = 0.4;
+    lodSelector.projectionFactor = framebufferHeight / (2.0 * tan(degrees_to_radians(60) / 2.0));
+    DrawItem backpack;
+    backpack.program = quadProgram;
+    backpack.depth = static_cast<float>(lodSelector.distance);
+    backpack.model = quadUniforms.model;
+    backpack.transform = &backpackTransform;
+	model1.Submit(renderQueue, backpack, lodSelector);
+
+    // Only the backpacks in view are uploaded, at a coarser LOD since they are all far away
+    DrawItem field;
+    field.program = quadProgram;
+    field.depth = static_cast<float>((camera.Position - vec3(0.0, -1.5, -50.0)).length());
+    model1.SubmitInstanced(renderQueue, field, backpackField, &frustum, 1);
 
-    // Light loop
-    for (GLuint i = 0; i < 8; i++)
+    mat4 model3;
+    model3 = translate(model3, vec3(-6.0, 0.0, 0.0));
+    planetTransform = instanceTransform(model3);
+    for (auto& face : planet.terrainFaces)
     {
-        std::string num = std::to_string(i);
-
-        glUniform3f(glGetUniformLocation(quadProgram, ("pointLights[" + num + "].position").c_str()),
-            pointPosition[0 + i * 3], pointPosition[1 + i * 3], pointPosition[2 + i * 3]);
-        glUniform3f(glGetUniformLocation(quadProgram,("pointLights[" + num + "].ambient").c_str()), 0.1f, 0.1f, 0.1f);
-        glUniform3f(glGetUniformLocation(quadProgram, ("pointLights[" + num + "].diffuse").c_str()), 0.3f, 0.3f, 0.3f);
-        glUniform3f(glGetUniformLocation(quadProgram, ("pointLights[" + num + "].specular").c_str()), 0.5f, 0.5f, 0.5f);
-        glUniform1f(glGetUniformLocation(quadProgram, ("pointLights[" + num + "].constant").c_str()), 1.0f);
-        glUniform1f(glGetUniformLocation(quadProgram, ("pointLights[" + num + "].linear").c_str()), 0.09f);
-        glUniform1f(glGetUniformLocation(quadProgram, ("pointLights[" + num + "].quadratic").c_str()), 0.0032f);
+        DrawItem planetFace;
+        planetFace.program = planetProgram;
+        planetFace.depth = static_cast<float>((camera.Position - vec3(-6.0, 0.0, 0.0)).length());
+        planetFace.model = planetUniforms.model;
+        planetFace.transform = &planetTransform;
+        planetFace = face.mesh.queueItem(planetFace);
+        planetFace.draw = drawPlanetFace;
+        planetFace.param = planet.applyGradient ? 1 : 0;
+        renderQueue.submit(planetFace);
     }
 
-    mat4 model0 = model;
-    for (int i = 0; i < 8; i++)
+    // The quad sits at the origin, so the camera vp places it
+    if (fractalVisible)
     {
-        model = translate(model0, vec3(-12 + 4 * i, -2, 0));
-        model = pitch(model, -90);
-        model = scale(model, 4);
+        DrawItem fractal;
+        fractal.program = fractalCompositeProgram;
+        fractal.material = fractalEffect.texture();
+        fractal.vertexArray = fractVAO;
+        fractal.depth = static_cast<float>((camera.Position - vec3(0.0, 0.0, -1.0)).length());
+        fractal.texture = fractalEffect.texture();
+        fractal.draw = drawFractal;
+        renderQueue.submit(fractal);
+    }
 
-        std::vector<float> formattedModel = model.toFloatVector();
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedModel.data()));
+    // Drawn at the far plane, LEQUAL lets it pass where nothing else was drawn
+    DrawItem skybox;
+    skybox.pass = RenderPass::Sky;
+    skybox.program = skyboxProgram;
+    skybox.material = cubemapTexture;
+    skybox.vertexArray = skyboxVAO;
+    skybox.textureTarget = GL_TEXTURE_CUBE_MAP;
+    skybox.texture = cubemapTexture;
+    skybox.depthFunc = GL_LEQUAL;
+    skybox.draw = drawSkybox;
+    renderQueue.submit(skybox);
+
+    DrawItem billboards;
+    billboards.pass = RenderPass::Transparent;
+    billboards.program = b_lightProgram;
+    billboards.vertexArray = b_lightVAO;
+    billboards.draw = drawBillboards;
+    renderQueue.submit(billboards);
+
+    renderQueue.execute();
+
+    if (overlay.soakTest)
+    {
+        for (auto& face : planet.terrainFaces)
+            face.update();
+    }
 
+     // Set a square around the sphere to pop IMGUI, press G to enbale mouse
+    bool showPlanetUI = camera.Position[0] < -3.0 && camera.Position[0] > -9.0 &&
+        camera.Position[2] < 6.0 && camera.Position[2] > -6.0;
 
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-        for (int j = 0; j < 8; j++)
+    if (showPlanetUI || overlay.visible)
+    {
+        beginUIFrame();
+        if (showPlanetUI)
         {
-            model = translate(model0, vec3(-12 + 4 * i, -2, -12 + 4 * j));
-            model = pitch(model, -90);
-            model = scale(model, 4);
-
-			std::vector<float> formattedModel = model.toFloatVector();
-			glUniformMatrix4fv(modelLoc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedModel.data()));
-
-            if (j != 3)
-                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
+            planet.RenderUI();
+            planet.update();
         }
+        if (overlay.visible)
+            overlay.Draw(collectMemory, now);
+        endUIFrame(window);
     }
-    
-    GLfloat camPos[] = {static_cast<GLfloat>(camera.Position.x()),
-        static_cast<GLfloat>(camera.Position.y()),
-        static_cast<GLfloat>(camera.Position.z())};
-
-	unsigned int viewPosLoc = glGetUniformLocation(quadProgram, "viewPos");
-    glUniform3fv(viewPosLoc, 1, camPos);
-
-    mat4 reset;
-    model = reset;
-    model = translate(model, vec3(4.0, 0.0, -2.0));
-    model = yaw(model, 180);
-	model = scale(model, 0.4);
-    std::vector<float> formattedModel = model.toFloatVector();
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedModel.data()));
-
-	model1.Draw(quadProgram);
-
-    glBindVertexArray(0);
-
-
-    // Start Planet program
-    glUseProgram(planetProgram);
-
-    mat4 vp3 = vp;
-    unsigned int vp3Loc = glGetUniformLocation(planetProgram, "vp");
-    std::vector<float> formattedVP3 = vp3.toFloatVector();
-	glUniformMatrix4fv(vp3Loc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedVP3.data()));
-
-    mat4 model3;
-    model3 = translate(model3, vec3(-6.0, 0.0, 0.0));
-	unsigned int modelLoc3 = glGetUniformLocation(planetProgram, "model");
-	std::vector<float> formattedModel3 = model3.toFloatVector();
-    glUniformMatrix4fv(modelLoc3, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedModel3.data()));
-
-	unsigned int viewPosLoc2 = glGetUniformLocation(planetProgram, "viewPos");
-    glUniform3fv(viewPosLoc2, 1, camPos);
-
-	if (planet.applyGradient)
-	{
-		unsigned int gradLoc = glGetUniformLocation(planetProgram, "applyGradient");
-		GLint start = 1;
-		glUniform1i(gradLoc, start);
-	}
-
-    planet.Draw(planetProgram);
-
-    // Begin Fractal program
-    glUseProgram(fractalProgram);
 
-    mat4 model2;
-    mat4 mvp2 = proj * view * model2;
-
-    unsigned int mvpLoc2 = glGetUniformLocation(fractalProgram, "mvp");
-    unsigned int timeLoc = glGetUniformLocation(fractalProgram, "time");
-
-    std::vector<float> formattedMVP2 = mvp2.toFloatVector();
-    glUniformMatrix4fv(mvpLoc2, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedMVP2.data()));
-
-    glUniform1f(timeLoc, static_cast<GLfloat>(now));
-
-    glBindVertexArray(fractVAO);
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-    glBindVertexArray(0);
-
-
-	// Begin skybox program
-	mat4 vp2 = proj * view;
-    glDepthFunc(GL_LEQUAL);
-    glUseProgram(skyboxProgram);
-
-    unsigned int vp2Loc = glGetUniformLocation(skyboxProgram, "vp");
-    std::vector<float> formattedVP2 = vp2.toFloatVector();
-	glUniformMatrix4fv(vp2Loc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedVP2.data()));
- 
-    // skybox cube
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
- 
-    glDepthFunc(GL_LESS); // set depth function back to default
-
-    //Begin billboard Light program
-    glUseProgram(b_lightProgram);
-    glBindVertexArray(b_lightVAO);
-
-    mat4 pointView = view;
-    mat4 pointProj = proj;
-
-    unsigned int viewLoc = glGetUniformLocation(b_lightProgram, "view");
-    unsigned int projLoc = glGetUniformLocation(b_lightProgram, "proj");
-
-    std::vector<float> formattedView = pointView.toFloatVector();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedView.data()));
-    std::vector<float> formattedProj = pointProj.toFloatVector();
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, reinterpret_cast<GLfloat*>(formattedProj.data()));
-
-    unsigned int pointSizeLoc = glGetUniformLocation(b_lightProgram, "pointSize");
-    unsigned int colorLoc = glGetUniformLocation(b_lightProgram, "pointColor");
-
-    glUniform1f(pointSizeLoc, pointSize);
-    glUniform4fv(colorLoc, 1, pointColor);
-
-    glDrawArrays(GL_POINTS, 0, 8);
-    glBindVertexArray(0);
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
 
-     // Set a square around the sphere to pop IMGUI, press G to enbale mouse
-    if (camera.Position[0] < -3.0 && camera.Position[0] > -9.0 &&
-        camera.Position[2] < 6.0 && camera.Position[2] > -6.0)
+#ifdef FRAME_STATS
+    if (now - lastStatsPrint > 1.0)
     {
-        planet.RenderUI(window);
-        planet.update();
+        frameStats.print();
+        lastStatsPrint = now;
     }
-
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+#endif
 }
 
 // Input Utils
@@ -621,6 +809,13 @@ void processInput(GLFWwindow* window, double deltaTime)
         camera.processKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.processKeyboard(RIGHT, deltaTime);
+
+    // Toggle the stats overlay on key press only
+    static bool overlayKeyDown = false;
+    bool overlayKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (overlayKey && !overlayKeyDown)
+        overlay.visible = !overlay.visible;
+    overlayKeyDown = overlayKey;
 }
 
 void processMouse(GLFWwindow* window, double xposIn, double yposIn)
@@ -654,37 +849,6 @@ void processMouse(GLFWwindow* window, double xposIn, double yposIn)
     }
 }
 
-unsigned int loadCubeMap(std::vector<std::string> faces)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrChannels;
-    for (int i = 0; i < faces.size(); i++)
-    {
-        unsigned char* cubemap_data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (cubemap_data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height,
-                0, GL_RGB, GL_UNSIGNED_BYTE, cubemap_data);
-            stbi_image_free(cubemap_data);
-        }
-        else
-        {
-            std::cout << "Failed to load cubemap at: " << faces[i] << std::endl;
-            stbi_image_free(cubemap_data);
-        }
-    }
-
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
-}
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
 {
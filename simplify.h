@@ -0,0 +1,422 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <GLES3/gl3.h>
+
+#include "vertex.h"
+#include "mesh_optimizer.h"
+
+// Quadric error metric simplification (Garland, Heckbert 97) by edge collapse onto
+// existing vertices, so every LOD shares the vertex buffer of the full mesh and only
+// needs its own index range.
+// Errors are relative to the mesh extent, 0.01 means one percent of the largest side.
+
+struct Quadric {
+	// Upper triangle of the symmetric 4x4 matrix
+	double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+	double a11 = 0, a12 = 0, a13 = 0;
+	double a22 = 0, a23 = 0;
+	double a33 = 0;
+	double weight = 0;
+
+	void addPlane(double a, double b, double c, double d, double w)
+	{
+		a00 += w * a * a; a01 += w * a * b; a02 += w * a * c; a03 += w * a * d;
+		a11 += w * b * b; a12 += w * b * c; a13 += w * b * d;
+		a22 += w * c * c; a23 += w * c * d;
+		a33 += w * d * d;
+		weight += w;
+	}
+
+	Quadric& operator+=(const Quadric& q)
+	{
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+		a11 += q.a11; a12 += q.a12; a13 += q.a13;
+		a22 += q.a22; a23 += q.a23;
+		a33 += q.a33;
+		weight += q.weight;
+		return *this;
+	}
+
+	// Mean squared distance of p to the accumulated planes
+	double error(const double p[3]) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+			+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+			+ a22 * z * z + 2 * a23 * z
+			+ a33;
+		return weight > 0 ? std::fabs(e) / weight : 0.0;
+	}
+};
+
+struct MeshLodOptions {
+	int levels = 3;
+	// Fraction of the previous level's triangles kept by the next one
+	float reduction = 0.5f;
+	// Relative error above which a level is not produced
+	float maxError = 0.1f;
+	// Weight of normal and UV differences against positional error
+	float attributeWeight = 0.05f;
+};
+
+// Largest side of the bounding box, the unit of every simplification error
+inline float meshExtent(const std::vector<Vertex>& vertices)
+{
+	if (vertices.empty())
+		return 0.0f;
+
+	float minP[3] = { vertices[0].Pos[0], vertices[0].Pos[1], vertices[0].Pos[2] };
+	float maxP[3] = { minP[0], minP[1], minP[2] };
+	for (const Vertex& vertex : vertices)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			minP[c] = std::min(minP[c], vertex.Pos[c]);
+			maxP[c] = std::max(maxP[c], vertex.Pos[c]);
+		}
+	}
+	return std::max(maxP[0] - minP[0], std::max(maxP[1] - minP[1], maxP[2] - minP[2]));
+}
+
+inline double attributeDistance(const Vertex& a, const Vertex& b)
+{
+	double n = 0.0;
+	for (int c = 0; c < 3; c++)
+		n += (a.Normal[c] - b.Normal[c]) * (a.Normal[c] - b.Normal[c]);
+	double uv = (a.TexUV[0] - b.TexUV[0]) * (a.TexUV[0] - b.TexUV[0])
+		+ (a.TexUV[1] - b.TexUV[1]) * (a.TexUV[1] - b.TexUV[1]);
+	// Opposite unit normals are 4 apart, bring them to the range of UV distances
+	return 0.25 * n + uv;
+}
+
+inline void triangleNormal(const double* p0, const double* p1, const double* p2, double n[3])
+{
+	double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// Returns a new index list of at most targetIndexCount indices if the error bound allows it.
+// Collapses move whole positions: every vertex on the source position, one per side of an
+// attribute seam, goes to the vertex on the target position it shares an edge with, so each
+// side keeps its own attributes. Identical vertices are merged first, so unwelded input
+// simplifies like welded input. Open borders are locked
+inline std::vector<GLuint> simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+	size_t targetIndexCount, float targetError, float* resultError = nullptr, float attributeWeight = 0.05f)
+{
+	size_t vertexCount = vertices.size();
+	if (resultError)
+		*resultError = 0.0f;
+
+	float extent = meshExtent(vertices);
+	if (indices.size() <= targetIndexCount || extent <= 0.0f)
+		return indices;
+
+	// Work in positions normalized by the extent so errors are relative
+	std::vector<double> positions(vertexCount * 3);
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		for (int c = 0; c < 3; c++)
+			positions[3 * v + c] = vertices[v].Pos[c] / extent;
+	}
+
+	// Group vertices sharing a position, the first one of each group stands for it.
+	// Members of a group are order[groupBegin[first]] up to groupEnd[first]
+	std::vector<GLuint> order(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++)
+		order[v] = static_cast<GLuint>(v);
+	std::sort(order.begin(), order.end(), [&](GLuint a, GLuint b) {
+		return std::lexicographical_compare(vertices[a].Pos, vertices[a].Pos + 3, vertices[b].Pos, vertices[b].Pos + 3);
+	});
+
+	std::vector<GLuint> group(vertexCount);
+	// First of the vertices identical to each one, the only one the result uses
+	std::vector<GLuint> canonical(vertexCount);
+	std::vector<size_t> groupBegin(vertexCount), groupEnd(vertexCount);
+	for (size_t i = 0; i < vertexCount;)
+	{
+		size_t j = i + 1;
+		while (j < vertexCount && std::equal(vertices[order[i]].Pos, vertices[order[i]].Pos + 3, vertices[order[j]].Pos))
+			j++;
+		for (size_t k = i; k < j; k++)
+		{
+			group[order[k]] = order[i];
+			canonical[order[k]] = order[k];
+			for (size_t m = i; m < k && canonical[order[k]] == order[k]; m++)
+			{
+				if (std::memcmp(&vertices[order[m]], &vertices[order[k]], sizeof(Vertex)) == 0)
+					canonical[order[k]] = canonical[order[m]];
+			}
+		}
+		groupBegin[order[i]] = i;
+		groupEnd[order[i]] = j;
+		i = j;
+	}
+
+	// Quadrics per position group, area weighted
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t + 2 < indices.size(); t += 3)
+	{
+		const double* p0 = &positions[3 * indices[t]];
+		const double* p1 = &positions[3 * indices[t + 1]];
+		const double* p2 = &positions[3 * indices[t + 2]];
+
+		double n[3];
+		triangleNormal(p0, p1, p2, n);
+		double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length <= 0.0)
+			continue;
+
+		double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+		double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+		for (int k = 0; k < 3; k++)
+			quadrics[group[indices[t + k]]].addPlane(a, b, c, d, 0.5 * length);
+	}
+
+	// Edges used by a single triangle are on an open border
+	std::vector<std::pair<GLuint, GLuint>> edges;
+	edges.reserve(indices.size());
+	for (size_t t = 0; t + 2 < indices.size(); t += 3)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint a = group[indices[t + k]];
+			GLuint b = group[indices[t + (k + 1) % 3]];
+			edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	std::vector<bool> borderGroup(vertexCount, false);
+	std::vector<bool> locked(vertexCount, false);
+	for (size_t i = 0; i < edges.size();)
+	{
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i])
+			j++;
+		if (j - i == 1)
+		{
+			borderGroup[edges[i].first] = true;
+			borderGroup[edges[i].second] = true;
+		}
+		i = j;
+	}
+	for (size_t v = 0; v < vertexCount; v++)
+	{
+		if (borderGroup[group[v]])
+			locked[v] = true;
+	}
+
+	struct Collapse {
+		GLuint from;
+		GLuint to;
+		double cost;
+	};
+
+	const GLuint NO_VERTEX = ~0u;
+	std::vector<GLuint> result(indices.size());
+	for (size_t i = 0; i < indices.size(); i++)
+		result[i] = canonical[indices[i]];
+	std::vector<Collapse> collapses;
+	std::vector<std::pair<GLuint, GLuint>> moves;
+	std::vector<GLuint> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1);
+	std::vector<unsigned int> adjacency;
+	double maxError = 0.0;
+	double errorLimit = static_cast<double>(targetError) * targetError;
+
+	while (result.size() > targetIndexCount)
+	{
+		size_t triangleCount = result.size() / 3;
+
+		// Triangles around each vertex, for the flip test
+		std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+		for (GLuint index : result)
+			adjacencyOffsets[index + 1]++;
+		for (size_t v = 0; v < vertexCount; v++)
+			adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+		adjacency.resize(result.size());
+		std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+				adjacency[fill[result[3 * t + k]]++] = static_cast<unsigned int>(t);
+		}
+
+		// Fills moves with where each vertex of from's position goes when from collapses onto
+		// to: the vertex of to's position it shares an edge with. Vertices no triangle uses any
+		// more are left out. False when one has no such edge, moving it would tear a seam
+		auto findMoves = [&](GLuint from, GLuint to) {
+			moves.clear();
+			GLuint fromGroup = group[from];
+			GLuint toGroup = group[to];
+			for (size_t m = groupBegin[fromGroup]; m < groupEnd[fromGroup]; m++)
+			{
+				GLuint vertex = order[m];
+				GLuint target = vertex == from ? to : NO_VERTEX;
+				for (unsigned int a = adjacencyOffsets[vertex]; a < adjacencyOffsets[vertex + 1] && target == NO_VERTEX; a++)
+				{
+					const GLuint* tri = &result[3 * adjacency[a]];
+					for (int k = 0; k < 3; k++)
+						target = group[tri[k]] == toGroup ? tri[k] : target;
+				}
+				if (target == NO_VERTEX && adjacencyOffsets[vertex] < adjacencyOffsets[vertex + 1])
+					return false;
+				if (target != NO_VERTEX)
+					moves.push_back(std::make_pair(vertex, target));
+			}
+			return true;
+		};
+
+		collapses.clear();
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				GLuint from = result[3 * t + k];
+				GLuint to = result[3 * t + (k + 1) % 3];
+				for (int direction = 0; direction < 2; direction++)
+				{
+					if (!locked[from] && group[from] != group[to] && findMoves(from, to))
+					{
+						Quadric q = quadrics[group[from]];
+						q += quadrics[group[to]];
+						double cost = q.error(&positions[3 * to]);
+						for (const std::pair<GLuint, GLuint>& move : moves)
+							cost += attributeWeight * attributeDistance(vertices[move.first], vertices[move.second]);
+						if (cost <= errorLimit)
+							collapses.push_back({ from, to, cost });
+					}
+					std::swap(from, to);
+				}
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(),
+			[](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		for (size_t v = 0; v < vertexCount; v++)
+			remap[v] = static_cast<GLuint>(v);
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t remainingTriangles = triangleCount;
+		size_t targetTriangles = targetIndexCount / 3;
+		size_t applied = 0;
+
+		for (const Collapse& collapse : collapses)
+		{
+			if (remainingTriangles <= targetTriangles)
+				break;
+			GLuint fromGroup = group[collapse.from];
+			GLuint toGroup = group[collapse.to];
+			if (touched[fromGroup] || touched[toGroup])
+				continue;
+			findMoves(collapse.from, collapse.to);
+
+			// Reject collapses that flip or degenerate a neighbouring triangle
+			bool flips = false;
+			for (size_t m = 0; m < moves.size() && !flips; m++)
+			{
+				GLuint from = moves[m].first;
+				GLuint to = moves[m].second;
+				for (unsigned int a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1] && !flips; a++)
+				{
+					const GLuint* tri = &result[3 * adjacency[a]];
+					if (tri[0] == to || tri[1] == to || tri[2] == to)
+						continue;
+
+					const double* before[3];
+					const double* after[3];
+					for (int k = 0; k < 3; k++)
+					{
+						before[k] = &positions[3 * tri[k]];
+						after[k] = tri[k] == from ? &positions[3 * to] : before[k];
+					}
+
+					double n0[3], n1[3];
+					triangleNormal(before[0], before[1], before[2], n0);
+					triangleNormal(after[0], after[1], after[2], n1);
+					if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0)
+						flips = true;
+				}
+			}
+			if (flips)
+				continue;
+
+			for (const std::pair<GLuint, GLuint>& move : moves)
+				remap[move.first] = move.second;
+			quadrics[toGroup] += quadrics[fromGroup];
+			// Per position, the representative vertex stands for its whole group
+			touched[fromGroup] = true;
+			touched[toGroup] = true;
+			maxError = std::max(maxError, collapse.cost);
+			// An interior edge collapse removes the two triangles sharing it, one per side of a seam
+			remainingTriangles = remainingTriangles > 2 ? remainingTriangles - 2 : 0;
+			applied++;
+		}
+
+		if (applied == 0)
+			break;
+
+		// Apply the collapses and drop triangles that became degenerate
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			GLuint a = remap[result[3 * t]];
+			GLuint b = remap[result[3 * t + 1]];
+			GLuint c = remap[result[3 * t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	if (resultError)
+		*resultError = static_cast<float>(std::sqrt(maxError));
+	return result;
+}
+
+// Simplifies level after level and appends each index list after the full detail one,
+// errors accumulate along the chain so they stay an upper bound against the original
+inline std::vector<MeshLod> buildLodChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+	const MeshLodOptions& options)
+{
+	std::vector<MeshLod> lods;
+	lods.push_back({ 0, static_cast<GLsizei>(indices.size()), 0.0f });
+
+	std::vector<GLuint> source = indices;
+	float error = 0.0f;
+
+	for (int level = 1; level <= options.levels; level++)
+	{
+		size_t target = static_cast<size_t>(source.size() / 3 * options.reduction) * 3;
+		if (target < 3 || error >= options.maxError)
+			break;
+
+		float levelError = 0.0f;
+		std::vector<GLuint> lod = simplifyMesh(vertices, source, target, options.maxError - error,
+			&levelError, options.attributeWeight);
+
+		// Not worth a level when the error bound stopped the simplifier early
+		if (lod.empty() || lod.size() > source.size() * 0.9)
+			break;
+
+		lod = optimizeVertexCache(lod, vertices.size());
+		error += levelError;
+
+		lods.push_back({ static_cast<GLsizei>(indices.size()), static_cast<GLsizei>(lod.size()), error });
+		indices.insert(indices.end(), lod.begin(), lod.end());
+		source.swap(lod);
+	}
+
+	return lods;
+}
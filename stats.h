@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+
+// Per frame counters, reset at the top of loop() and printed about once a second
+// when the FRAME_STATS option is enabled
+struct FrameStats {
+	unsigned int drawCalls = 0;
+	unsigned int glCalls = 0;
+	unsigned int uniformLookups = 0;
+	// Camera and Lights blocks written, at most one each per frame
+	unsigned int uniformBufferUploads = 0;
+	// Instances drawn by instanced draws, and those the frustum test dropped
+	unsigned int instances = 0;
+	unsigned int culledInstances = 0;
+	// Items issued by the render queue and the state changes it made for them
+	unsigned int drawItems = 0;
+	unsigned int programBinds = 0;
+	unsigned int vertexArrayBinds = 0;
+	unsigned int textureBinds = 0;
+	// Binds and toggles glState passed on to GL, and those it dropped as already current
+	unsigned int glStateIssued = 0;
+	unsigned int glStateFiltered = 0;
+	// Loader threads allocate too
+	std::atomic<unsigned long> allocations{ 0 };
+
+	void reset()
+	{
+		drawCalls = 0;
+		glCalls = 0;
+		uniformLookups = 0;
+		uniformBufferUploads = 0;
+		instances = 0;
+		culledInstances = 0;
+		drawItems = 0;
+		programBinds = 0;
+		vertexArrayBinds = 0;
+		textureBinds = 0;
+		glStateIssued = 0;
+		glStateFiltered = 0;
+		allocations = 0;
+	}
+
+	void print() const
+	{
+		std::cout << "Frame stats - draws: " << drawCalls
+			<< " gl calls: " << glCalls
+			<< " uniform lookups: " << uniformLookups
+			<< " uniform buffer uploads: " << uniformBufferUploads
+			<< " instances: " << instances << " (" << culledInstances << " culled)"
+			<< " draw items: " << drawItems << " (" << programBinds << " program, " << vertexArrayBinds
+			<< " vertex array, " << textureBinds << " texture binds)"
+			<< " gl state: " << glStateIssued << " issued, " << glStateFiltered << " filtered"
+			<< " allocations: " << allocations << std::endl;
+	}
+};
+
+inline FrameStats frameStats;
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "vertex.h"
+
+// Per vertex tangent frames for normal and height mapping, from positions and UVs.
+// Triangle tangents are summed per vertex weighted by their UV area, then made
+// orthogonal to the vertex normal. Vertices shared across a UV mirror seam average both
+// sides, importers split those so in practice each vertex sees one handedness.
+
+inline void computeTangents(std::vector<Vertex>& vertices, const std::vector<GLuint>& indices)
+{
+	std::vector<float> tangents(vertices.size() * 3, 0.0f);
+	std::vector<float> bitangents(vertices.size() * 3, 0.0f);
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const Vertex& v0 = vertices[indices[i]];
+		const Vertex& v1 = vertices[indices[i + 1]];
+		const Vertex& v2 = vertices[indices[i + 2]];
+
+		float e1[3], e2[3];
+		for (int c = 0; c < 3; c++)
+		{
+			e1[c] = v1.Pos[c] - v0.Pos[c];
+			e2[c] = v2.Pos[c] - v0.Pos[c];
+		}
+		float du1 = v1.TexUV[0] - v0.TexUV[0], dv1 = v1.TexUV[1] - v0.TexUV[1];
+		float du2 = v2.TexUV[0] - v0.TexUV[0], dv2 = v2.TexUV[1] - v0.TexUV[1];
+
+		// Unnormalized, so larger triangles in UV space count for more
+		float det = du1 * dv2 - du2 * dv1;
+		if (std::fabs(det) < 1e-12f)
+			continue;
+		float sign = det < 0.0f ? -1.0f : 1.0f;
+
+		for (int k = 0; k < 3; k++)
+		{
+			GLuint index = indices[i + k];
+			for (int c = 0; c < 3; c++)
+			{
+				tangents[index * 3 + c] += (e1[c] * dv2 - e2[c] * dv1) * sign;
+				bitangents[index * 3 + c] += (e2[c] * du1 - e1[c] * du2) * sign;
+			}
+		}
+	}
+
+	for (size_t v = 0; v < vertices.size(); v++)
+	{
+		Vertex& vertex = vertices[v];
+		const float* n = vertex.Normal;
+		const float* t = &tangents[v * 3];
+		const float* b = &bitangents[v * 3];
+
+		float d = n[0] * t[0] + n[1] * t[1] + n[2] * t[2];
+		float ortho[3] = { t[0] - n[0] * d, t[1] - n[1] * d, t[2] - n[2] * d };
+		float length = std::sqrt(ortho[0] * ortho[0] + ortho[1] * ortho[1] + ortho[2] * ortho[2]);
+		if (length < 1e-12f)
+			continue; // no UVs around it, keep the default frame
+
+		for (int c = 0; c < 3; c++)
+			vertex.Tangent[c] = ortho[c] / length;
+
+		float cross[3] = { n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0] };
+		vertex.Tangent[3] = cross[0] * b[0] + cross[1] * b[1] + cross[2] * b[2] < 0.0f ? -1.0f : 1.0f;
+	}
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "mesh.h"
+#include "render_queue.h"
+#include "stats.h"
+#include "texture_cache.h"
+
+// Material textures packed as layers of one GL_TEXTURE_2D_ARRAY per texture type.
+// Every material gets a layer index valid in all the arrays, so meshes of different
+// materials draw with the same textures bound and only switch the materialLayer uniform.
+// The arrays sit on their own units from TEXTURE_ARRAY_UNIT, a sampler2D and a
+// sampler2DArray must never share a unit so programs assign them once at setup.
+
+const GLint TEXTURE_ARRAY_UNIT = 8;
+
+// Types the fragment shader samples, specular maps are not read so get no array.
+// Diffuse comes first, the only sRGB one
+const char* const TEXTURE_ARRAY_TYPES[] = { "texture_diffuse", "texture_normal", "texture_height" };
+const int TEXTURE_ARRAY_TYPE_COUNT = 3;
+
+// "texture_diffuse" is sampled from "layers_diffuse"
+inline std::string textureArraySampler(const std::string& type)
+{
+	return "layers_" + type.substr(type.find('_') + 1);
+}
+
+// Points the layers_ samplers of the current program at their units
+inline void assignTextureArrayUnits(GLuint program)
+{
+	for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+		glUniform1i(glGetUniformLocation(program, textureArraySampler(TEXTURE_ARRAY_TYPES[t]).c_str()), TEXTURE_ARRAY_UNIT + t);
+}
+
+class TextureArrayBuilder {
+public:
+	// Layer of the material made of textures, materials using the same files share one
+	GLint addMaterial(const std::vector<Texture>& textures)
+	{
+		std::string paths[TEXTURE_ARRAY_TYPE_COUNT];
+		for (const Texture& texture : textures)
+		{
+			for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+			{
+				if (texture.type == TEXTURE_ARRAY_TYPES[t] && paths[t].empty())
+					paths[t] = texture.path;
+			}
+		}
+
+		for (size_t layer = 0; layer < layers(); layer++)
+		{
+			bool same = true;
+			for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+				same = same && layerPaths[t][layer] == paths[t];
+			if (same)
+				return static_cast<GLint>(layer);
+		}
+
+		for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+			layerPaths[t].push_back(paths[t]);
+		return static_cast<GLint>(layers() - 1);
+	}
+
+	// Loads every array through textureCache, paths are relative to directory.
+	// False when the images of some type differ in size and cannot share an array
+	bool build(const std::string& directory)
+	{
+		for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+		{
+			arrays[t].reset();
+			std::string filler;
+			for (const std::string& path : layerPaths[t])
+				filler = filler.empty() ? path : filler;
+			if (filler.empty())
+				continue;
+
+			// Materials without that type take any image of it, their meshes never sample it
+			std::vector<std::string> files;
+			for (const std::string& path : layerPaths[t])
+				files.push_back(directory + '/' + (path.empty() ? filler : path));
+			arrays[t] = textureCache.loadArray(files, true, t == 0);
+			if (!arrays[t].get())
+				return false;
+		}
+		return true;
+	}
+
+	// Binds the arrays on their units, once for every mesh drawn after
+	void bind() const
+	{
+		for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+		{
+			if (!arrays[t].get())
+				continue;
+			glState.bindTexture(GL_TEXTURE0 + TEXTURE_ARRAY_UNIT + t, GL_TEXTURE_2D_ARRAY, arrays[t]);
+		}
+	}
+
+	// Same for a RenderQueue item, bound when the item is issued
+	void attach(DrawItem& item) const
+	{
+		item.unitTextureCount = 0;
+		for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT && item.unitTextureCount < MAX_UNIT_TEXTURES; t++)
+		{
+			if (!arrays[t].get())
+				continue;
+			UnitTexture& bound = item.unitTextures[item.unitTextureCount++];
+			bound.unit = GL_TEXTURE0 + TEXTURE_ARRAY_UNIT + t;
+			bound.target = GL_TEXTURE_2D_ARRAY;
+			bound.texture = arrays[t];
+		}
+	}
+
+	size_t layers() const { return layerPaths[0].size(); }
+
+	void clear()
+	{
+		for (int t = 0; t < TEXTURE_ARRAY_TYPE_COUNT; t++)
+		{
+			layerPaths[t].clear();
+			arrays[t].reset();
+		}
+	}
+
+private:
+	// Per type, the file of every layer, empty when that material has none
+	std::vector<std::string> layerPaths[TEXTURE_ARRAY_TYPE_COUNT];
+	SharedTexture arrays[TEXTURE_ARRAY_TYPE_COUNT];
+};
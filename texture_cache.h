@@ -0,0 +1,490 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+#include "texture_loader.h"
+#include "ktx2.h"
+#include "memory_stats.h"
+
+// Process wide texture store, every loader goes through textureCache so a file is
+// decoded and uploaded once however many models or paths refer to it.
+// Lookups go by canonical path first, then by a hash of the file contents so copies
+// of the same image under other names share one texture too.
+// Textures live as long as a SharedTexture refers to them.
+// 2D textures hold a 1x1 placeholder from the start and stream their levels in through
+// pollLoads, called once per frame, or all at once through finishLoads.
+// An image with a .ktx2 beside it (tools/texture_compressor) is uploaded compressed
+// instead, when the GPU reads its format and its orientation matches the load.
+
+// Collapses "//", "./" and "dir/.." so one file always has one name
+inline std::string canonicalPath(const std::string& path)
+{
+	std::vector<std::string> parts;
+	size_t start = 0;
+	while (start <= path.size())
+	{
+		size_t end = path.find('/', start);
+		if (end == std::string::npos)
+			end = path.size();
+		std::string part = path.substr(start, end - start);
+		if (part == "..")
+		{
+			if (!parts.empty() && parts.back() != "..")
+				parts.pop_back();
+			else if (path.empty() || path[0] != '/')
+				parts.push_back(part);
+		}
+		else if (!part.empty() && part != ".")
+		{
+			parts.push_back(part);
+		}
+		start = end + 1;
+	}
+
+	std::string canonical = !path.empty() && path[0] == '/' ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++)
+		canonical += (i ? "/" : "") + parts[i];
+	return canonical;
+}
+
+// FNV-1a, only used to spot identical files, not for security
+inline uint64_t hashBytes(const std::vector<unsigned char>& bytes, uint64_t hash = 14695981039346656037ull)
+{
+	for (unsigned char byte : bytes)
+	{
+		hash ^= byte;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+class SharedTexture;
+
+class TextureCache {
+public:
+	// Decode starts right away on threadPool(), the texture is filled by pollLoads or finishLoads.
+	// srgb marks color maps, their mips are filtered in linear space
+	SharedTexture load(const std::string& path, bool flipVertically = true, bool srgb = false);
+
+	// Faces in the order +X, -X, +Y, -Y, +Z, -Z, cached as a whole. Empty when a face is
+	// unreadable or the faces differ in size
+	SharedTexture loadCubeMap(const std::vector<std::string>& faces, bool flipVertically = true, bool srgb = false);
+
+	// RGBA8 GL_TEXTURE_2D_ARRAY with one layer per file, in order, cached as a whole.
+	// Empty when a file is unreadable or the images differ in size.
+	// Layers read black until their decode lands, compressed .ktx2 files are not used
+	SharedTexture loadArray(const std::vector<std::string>& layers, bool flipVertically = true, bool srgb = false);
+
+	// Uploads everything loaded so far, blocks until the pending decodes are done
+	void finishLoads()
+	{
+		batch.finish();
+		settle();
+	}
+
+	// Uploads what is ready within the budget, true once nothing is left to load
+	bool pollLoads(double budgetMilliseconds = 2.0)
+	{
+		if (batch.empty())
+			return true;
+		if (!batch.poll(budgetMilliseconds))
+			return false;
+		settle();
+		return true;
+	}
+
+	GLuint id(uint64_t key) const
+	{
+		auto it = entries.find(key);
+		return it == entries.end() ? 0 : it->second.texture.get();
+	}
+
+	void addRef(uint64_t key)
+	{
+		auto it = entries.find(key);
+		if (it != entries.end())
+			it->second.refs++;
+	}
+
+	// The last release deletes the texture, unless its upload is still pending
+	void release(uint64_t key)
+	{
+		auto it = entries.find(key);
+		if (it == entries.end())
+			return;
+		if (--it->second.refs == 0 && !it->second.pending)
+			erase(it);
+	}
+
+	size_t size() const { return entries.size(); }
+
+	// One entry per texture under its first name, cube maps apart from 2D textures.
+	// Decoded images waiting in the batch are not counted, they only live while loading
+	void reportMemory(MemoryReport& report) const
+	{
+		for (const auto& [key, entry] : entries)
+		{
+			AssetMemory usage;
+			usage.subsystem = entry.names[0].compare(0, 5, "cube:") == 0 ? "Cubemaps" :
+				entry.names[0].compare(0, 6, "array:") == 0 ? "Texture arrays" : "Textures";
+			usage.name = entry.names[0];
+			usage.cpuBytes = sizeof(Entry) + vectorBytes(entry.names);
+			usage.gpuBytes = entry.texture.size();
+			usage.count = 1;
+			report.add(usage);
+		}
+	}
+
+	// Requests served by path, by identical contents, real decodes and KTX2 uploads
+	unsigned int pathHits = 0;
+	unsigned int contentHits = 0;
+	unsigned int decodes = 0;
+	unsigned int compressedLoads = 0;
+
+private:
+	struct Entry {
+		GLTexture texture;
+		int refs = 0;
+		bool pending = false;
+		std::vector<std::string> names;
+		// What a content hit is checked against: the key before probing, the files the
+		// texture was made from and their total size
+		uint64_t contentKey = 0;
+		std::vector<std::string> sources;
+		size_t contentBytes = 0;
+	};
+
+	// Files read for one load, paired with their bytes
+	using Contents = std::vector<std::pair<std::string, const std::vector<unsigned char>*>>;
+
+	// unordered_map keeps entries in place, the batch holds pointers to their textures
+	std::unordered_map<uint64_t, Entry> entries;
+	std::unordered_map<std::string, uint64_t> byName;
+	TextureBatch batch;
+
+	// Batch is empty, entries released while it was busy can go now
+	void settle()
+	{
+		for (auto it = entries.begin(); it != entries.end();)
+		{
+			it->second.pending = false;
+			if (it->second.refs == 0)
+				it = erase(it);
+			else
+				++it;
+		}
+	}
+
+	std::unordered_map<uint64_t, Entry>::iterator erase(std::unordered_map<uint64_t, Entry>::iterator it)
+	{
+		for (const std::string& name : it->second.names)
+			byName.erase(name);
+		return entries.erase(it);
+	}
+
+	// Content lookup once the name missed, returns the entry key or creates the entry with
+	// create(entry) when nothing matches. A hash hit only counts when the cached files still
+	// hold the same bytes, a collision probes on to the next key
+	template <typename Create>
+	uint64_t find(const std::string& name, uint64_t contentKey, const Contents& contents, Create create)
+	{
+		uint64_t key = contentKey;
+		for (auto existing = entries.find(key); existing != entries.end(); existing = entries.find(key))
+		{
+			if (sameContents(existing->second, contentKey, contents))
+			{
+				contentHits++;
+				existing->second.names.push_back(name);
+				byName[name] = key;
+				return key;
+			}
+			key = key * 1099511628211ull + 1;
+		}
+
+		Entry& entry = entries[key];
+		entry.texture = createGLTexture();
+		entry.pending = true;
+		entry.names.push_back(name);
+		entry.contentKey = contentKey;
+		for (const auto& [source, bytes] : contents)
+		{
+			entry.sources.push_back(source);
+			entry.contentBytes += bytes->size();
+		}
+		byName[name] = key;
+		create(entry);
+		return key;
+	}
+
+	// Sizes first, the cached files are only read again when those agree
+	static bool sameContents(const Entry& entry, uint64_t contentKey, const Contents& contents)
+	{
+		if (entry.contentKey != contentKey || entry.sources.size() != contents.size())
+			return false;
+		size_t total = 0;
+		for (const auto& content : contents)
+			total += content.second->size();
+		if (total != entry.contentBytes)
+			return false;
+		for (size_t i = 0; i < contents.size(); i++)
+		{
+			if (readFileBytes(entry.sources[i]) != *contents[i].second)
+				return false;
+		}
+		return true;
+	}
+
+	// True when the .ktx2 of path exists and can be uploaded as is, image points into bytes
+	static bool readCompressed(const std::string& path, bool flipVertically, std::vector<unsigned char>& bytes,
+		Ktx2Image& image)
+	{
+		bytes = readFileBytes(ktx2Path(path));
+		return !bytes.empty() && parseKtx2(bytes, image) && image.bottomUp == flipVertically &&
+			ktx2FormatSupported(image.glFormat);
+	}
+
+	bool findName(const std::string& name, uint64_t& key)
+	{
+		auto it = byName.find(name);
+		if (it == byName.end())
+			return false;
+		pathHits++;
+		key = it->second;
+		return true;
+	}
+};
+
+// Never destroyed, SharedTexture globals can be torn down after any other static
+inline TextureCache& textureCache = *new TextureCache();
+
+// Counted reference to a textureCache entry, copies share the texture
+class SharedTexture {
+public:
+	SharedTexture() = default;
+	explicit SharedTexture(uint64_t a_key) : key(a_key), valid(true) { textureCache.addRef(key); }
+
+	SharedTexture(const SharedTexture& other) : key(other.key), valid(other.valid)
+	{
+		if (valid)
+			textureCache.addRef(key);
+	}
+
+	SharedTexture(SharedTexture&& other) noexcept : key(other.key), valid(other.valid)
+	{
+		other.valid = false;
+	}
+
+	SharedTexture& operator=(SharedTexture other) noexcept
+	{
+		std::swap(key, other.key);
+		std::swap(valid, other.valid);
+		return *this;
+	}
+
+	~SharedTexture() { reset(); }
+
+	void reset()
+	{
+		if (valid)
+			textureCache.release(key);
+		valid = false;
+	}
+
+	GLuint get() const { return valid ? textureCache.id(key) : 0; }
+	operator GLuint() const { return get(); }
+
+private:
+	uint64_t key = 0;
+	bool valid = false;
+};
+
+inline SharedTexture TextureCache::load(const std::string& path, bool flipVertically, bool srgb)
+{
+	std::string canonical = canonicalPath(path);
+	std::string name = canonical + (flipVertically ? "#flip" : "") + (srgb ? "#srgb" : "");
+	uint64_t key;
+	if (findName(name, key))
+		return SharedTexture(key);
+
+	std::vector<unsigned char> compressed;
+	Ktx2Image image;
+	if (readCompressed(canonical, flipVertically, compressed, image))
+	{
+		Contents contents = { { ktx2Path(canonical), &compressed } };
+		key = find(name, hashBytes(compressed) ^ (flipVertically ? 1 : 0), contents, [&](Entry& entry) {
+			compressedLoads++;
+			uploadPlaceholder(entry.texture);
+			batch.add(entry.texture, canonical, std::make_shared<std::vector<unsigned char>>(std::move(compressed)), image);
+		});
+		return SharedTexture(key);
+	}
+
+	std::vector<unsigned char> bytes = readFileBytes(canonical);
+	if (bytes.empty())
+	{
+		std::cout << "Texture failed to load at path: " << canonical << std::endl;
+		return SharedTexture();
+	}
+
+	// Other mips with srgb, so not the same texture
+	uint64_t contentKey = hashBytes(bytes) ^ (flipVertically ? 1 : 0) ^ (srgb ? 8 : 0);
+	Contents contents = { { canonical, &bytes } };
+	key = find(name, contentKey, contents, [&](Entry& entry) {
+		decodes++;
+		uploadPlaceholder(entry.texture);
+		batch.add(entry.texture, GL_TEXTURE_2D, canonical, std::move(bytes), flipVertically, srgb);
+	});
+	return SharedTexture(key);
+}
+
+inline SharedTexture TextureCache::loadCubeMap(const std::vector<std::string>& faces, bool flipVertically, bool srgb)
+{
+	std::string name = "cube";
+	for (const std::string& face : faces)
+		name += ":" + canonicalPath(face);
+	name += std::string(flipVertically ? "#flip" : "") + (srgb ? "#srgb" : "");
+	uint64_t key;
+	if (findName(name, key))
+		return SharedTexture(key);
+	if (faces.empty())
+		return SharedTexture();
+
+	// Compressed only when every face is
+	std::vector<std::vector<unsigned char>> faceBytes(faces.size());
+	std::vector<Ktx2Image> images(faces.size());
+	bool compressed = !faces.empty();
+	for (size_t i = 0; i < faces.size() && compressed; i++)
+		compressed = readCompressed(canonicalPath(faces[i]), flipVertically, faceBytes[i], images[i]);
+
+	// Storage is allocated up front from the headers, every face has to match the first
+	int width = 0, height = 0, components = 0;
+	uint64_t contentKey = 14695981039346656037ull;
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		if (!compressed)
+		{
+			faceBytes[i] = readFileBytes(canonicalPath(faces[i]));
+			int w = 0, h = 0, c = 0;
+			if (faceBytes[i].empty() || !stbi_info_from_memory(faceBytes[i].data(), static_cast<int>(faceBytes[i].size()),
+				&w, &h, &c))
+			{
+				std::cout << "Texture failed to load at path: " << canonicalPath(faces[i]) << std::endl;
+				return SharedTexture();
+			}
+			if (i > 0 && (w != width || h != height))
+			{
+				std::cout << canonicalPath(faces[i]) << " is " << w << "x" << h << ", the cube map is " << width << "x"
+					<< height << std::endl;
+				return SharedTexture();
+			}
+			width = w;
+			height = h;
+			components = i == 0 ? c : components;
+		}
+		contentKey = hashBytes(faceBytes[i], contentKey);
+	}
+	// Keeps a cube map apart from a 2D texture of the same bytes
+	contentKey ^= (flipVertically ? 3 : 2) ^ (srgb && !compressed ? 8 : 0);
+	Contents contents;
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		std::string face = canonicalPath(faces[i]);
+		contents.push_back({ compressed ? ktx2Path(face) : face, &faceBytes[i] });
+	}
+
+	key = find(name, contentKey, contents, [&](Entry& entry) {
+		glState.bindTexture(GL_TEXTURE_CUBE_MAP, entry.texture);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+		if (compressed)
+		{
+			compressedLoads += static_cast<unsigned int>(faces.size());
+			for (size_t i = 0; i < faces.size(); i++)
+				uploadKtx2(entry.texture, GL_TEXTURE_CUBE_MAP_POSITIVE_X + static_cast<GLenum>(i), images[i]);
+			GLint levels = static_cast<GLint>(images[0].levels.size());
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, levels - 1);
+			glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+			entry.pending = false;
+			return;
+		}
+
+		// Faces stay black until all six land, the cube is sampled whole
+		int levels = mipLevelCount(width, height);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, storageFormat(components), width, height);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		entry.texture.setBytes(textureBytes(width, height, components, true) * static_cast<long long>(faces.size()));
+
+		decodes += static_cast<unsigned int>(faces.size());
+		for (size_t i = 0; i < faces.size(); i++)
+			batch.add(entry.texture, GL_TEXTURE_CUBE_MAP_POSITIVE_X + static_cast<GLenum>(i), faces[i],
+				std::move(faceBytes[i]), flipVertically, srgb, components);
+	});
+	return SharedTexture(key);
+}
+
+inline SharedTexture TextureCache::loadArray(const std::vector<std::string>& layers, bool flipVertically, bool srgb)
+{
+	std::string name = "array";
+	for (const std::string& layer : layers)
+		name += ":" + canonicalPath(layer);
+	name += std::string(flipVertically ? "#flip" : "") + (srgb ? "#srgb" : "");
+	uint64_t key;
+	if (findName(name, key))
+		return SharedTexture(key);
+	if (layers.empty())
+		return SharedTexture();
+
+	// Sizes come from the headers, every layer has to match before anything is decoded
+	std::vector<std::vector<unsigned char>> layerBytes(layers.size());
+	int width = 0, height = 0;
+	uint64_t contentKey = 14695981039346656037ull;
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		layerBytes[i] = readFileBytes(canonicalPath(layers[i]));
+		int w = 0, h = 0, components = 0;
+		if (layerBytes[i].empty() || !stbi_info_from_memory(layerBytes[i].data(), static_cast<int>(layerBytes[i].size()),
+			&w, &h, &components))
+		{
+			std::cout << "Texture failed to load at path: " << canonicalPath(layers[i]) << std::endl;
+			return SharedTexture();
+		}
+		if (i > 0 && (w != width || h != height))
+		{
+			std::cout << canonicalPath(layers[i]) << " is " << w << "x" << h << ", the texture array is " << width
+				<< "x" << height << std::endl;
+			return SharedTexture();
+		}
+		width = w;
+		height = h;
+		contentKey = hashBytes(layerBytes[i], contentKey);
+	}
+	// Apart from cube maps and 2D textures of the same bytes
+	contentKey ^= (flipVertically ? 5 : 4) ^ (srgb ? 8 : 0);
+	Contents contents;
+	for (size_t i = 0; i < layers.size(); i++)
+		contents.push_back({ canonicalPath(layers[i]), &layerBytes[i] });
+
+	key = find(name, contentKey, contents, [&](Entry& entry) {
+		GLsizei levels = mipLevelCount(width, height);
+		glState.bindTexture(GL_TEXTURE_2D_ARRAY, entry.texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height, static_cast<GLsizei>(layers.size()));
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		entry.texture.setBytes(textureBytes(width, height, 4, true) * static_cast<long long>(layers.size()));
+
+		decodes += static_cast<unsigned int>(layers.size());
+		for (size_t i = 0; i < layers.size(); i++)
+			batch.addLayer(entry.texture, static_cast<GLint>(i), layers[i], std::move(layerBytes[i]), flipVertically, srgb);
+	});
+	return SharedTexture(key);
+}
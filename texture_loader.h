@@ -0,0 +1,388 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+#include "thread_pool.h"
+#include "stb_image.h"
+#include "ktx2.h"
+#include "mip_generator.h"
+
+// Image files are split into decode, which is plain CPU work any thread can do,
+// and upload, which needs the GL context and so stays on the main thread.
+// Mip chains are built on the workers too (mip_generator.h) and go into immutable
+// glTexStorage2D storage, nothing calls glGenerateMipmap on the main thread.
+// 2D textures stream in: a 1x1 placeholder first, then their mips smallest first,
+// so anything drawn with them is textured from the first frame and sharpens as they arrive.
+
+struct DecodedImage {
+	int width = 0;
+	int height = 0;
+	int components = 0;
+	std::unique_ptr<unsigned char, void (*)(void*)> pixels{ nullptr, stbi_image_free };
+};
+
+// Whole file in memory, read on the main thread so workers never go through the file system
+inline std::vector<unsigned char> readFileBytes(const std::string& filename)
+{
+	std::vector<unsigned char> bytes;
+	FILE* file = std::fopen(filename.c_str(), "rb");
+	if (!file)
+		return bytes;
+	std::fseek(file, 0, SEEK_END);
+	long size = std::ftell(file);
+	std::fseek(file, 0, SEEK_SET);
+	if (size > 0)
+	{
+		bytes.resize(static_cast<size_t>(size));
+		if (std::fread(bytes.data(), 1, bytes.size(), file) != bytes.size())
+			bytes.clear();
+	}
+	std::fclose(file);
+	return bytes;
+}
+
+// Flip is per thread in stb_image, so workers never depend on a global set elsewhere.
+// components forces the channel count, 0 keeps the file's
+inline DecodedImage decodeImage(const std::vector<unsigned char>& bytes, bool flipVertically, int components = 0)
+{
+	DecodedImage image;
+	stbi_set_flip_vertically_on_load_thread(flipVertically);
+	if (!bytes.empty())
+		image.pixels.reset(stbi_load_from_memory(bytes.data(), static_cast<int>(bytes.size()),
+			&image.width, &image.height, &image.components, components));
+	if (components)
+		image.components = components;
+	return image;
+}
+
+inline GLenum pixelFormat(int components)
+{
+	if (components == 1)
+		return GL_RED;
+	if (components == 2)
+		return GL_RG;
+	if (components == 4)
+		return GL_RGBA;
+	return GL_RGB;
+}
+
+// Sized format of the immutable storage for that many 8 bit channels
+inline GLenum storageFormat(int components)
+{
+	if (components == 1)
+		return GL_R8;
+	if (components == 2)
+		return GL_RG8;
+	if (components == 4)
+		return GL_RGBA8;
+	return GL_RGB8;
+}
+
+inline GLenum imageFormat(const DecodedImage& image)
+{
+	return pixelFormat(image.components);
+}
+
+// Levels 1 to 1x1, srgb for color maps
+inline std::vector<MipLevel> buildMipChain(const DecodedImage& image, bool srgb)
+{
+	return buildMipChain(image.pixels.get(), image.width, image.height, image.components, srgb);
+}
+
+// Mid grey 1x1 sampled until the real levels stream in
+inline void uploadPlaceholder(GLTexture& texture)
+{
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	glState.bindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	texture.setBytes(4);
+}
+
+// Every level of one face of a cube map whose storage is already allocated,
+// face is GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+inline bool uploadCubeMapFace(GLTexture& texture, GLenum face, const DecodedImage& image, const std::vector<MipLevel>& mips)
+{
+	if (!image.pixels)
+		return false;
+
+	GLenum format = imageFormat(image);
+	glState.bindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(face, 0, 0, 0, image.width, image.height, format, GL_UNSIGNED_BYTE, image.pixels.get());
+	for (size_t level = 0; level < mips.size(); level++)
+	{
+		glTexSubImage2D(face, static_cast<GLint>(level + 1), 0, 0, mips[level].width, mips[level].height, format,
+			GL_UNSIGNED_BYTE, mips[level].pixels.data());
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	return true;
+}
+
+// Every level of one RGBA layer of a texture array whose storage is already allocated
+inline void uploadArrayLayer(GLTexture& texture, GLint layer, const DecodedImage& image, const std::vector<MipLevel>& mips)
+{
+	glState.bindTexture(GL_TEXTURE_2D_ARRAY, texture);
+	glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, image.width, image.height, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+		image.pixels.get());
+	for (size_t level = 0; level < mips.size(); level++)
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level + 1), 0, 0, layer, mips[level].width,
+			mips[level].height, 1, GL_RGBA, GL_UNSIGNED_BYTE, mips[level].pixels.data());
+	}
+}
+
+// Images decode and build their mips on threadPool() as they are added, or inside poll()
+// when the pool has no workers. poll() then uploads within a time budget: cube map faces and texture array layers whole as their
+// decode completes, 2D textures one level at a time, smallest first and round robin so
+// every texture gets its coarse levels early. finish() does the same blocking.
+// Cube maps and arrays come with their storage allocated by whoever created them,
+// 2D textures hold a placeholder until the batch allocates theirs.
+class TextureBatch {
+public:
+	TextureBatch() = default;
+	TextureBatch(const TextureBatch&) = delete;
+	TextureBatch& operator=(const TextureBatch&) = delete;
+
+	// Jobs hold a pointer to the queue, wait for them even if finish was never called
+	~TextureBatch()
+	{
+		for (; pending > 0; pending--)
+			completed.pop();
+	}
+
+	// texture must outlive the upload, target is GL_TEXTURE_2D or a cube map face.
+	// srgb filters the mips of color maps in linear space, components forces the channel
+	// count a cube map's storage was allocated with
+	void add(GLTexture& texture, GLenum target, const std::string& filename, std::vector<unsigned char> bytes,
+		bool flipVertically, bool srgb = false, int components = 0)
+	{
+		submit({ &texture, target, filename, 0, components, srgb }, std::move(bytes), flipVertically);
+	}
+
+	// One layer of a GL_TEXTURE_2D_ARRAY with RGBA8 storage for all its levels, the image
+	// is converted to RGBA and must match the array size
+	void addLayer(GLTexture& texture, GLint layer, const std::string& filename, std::vector<unsigned char> bytes,
+		bool flipVertically, bool srgb = false)
+	{
+		submit({ &texture, GL_TEXTURE_2D_ARRAY, filename, layer, 4, srgb }, std::move(bytes), flipVertically);
+	}
+
+	// Compressed 2D texture, nothing to decode so it streams straight away.
+	// image points into bytes, which the stream keeps alive
+	void add(GLTexture& texture, const std::string& filename, std::shared_ptr<std::vector<unsigned char>> bytes,
+		const Ktx2Image& image)
+	{
+		Stream stream;
+		stream.texture = &texture;
+		stream.filename = filename;
+		stream.compressedBytes = std::move(bytes);
+		stream.compressed = image;
+		stream.levels = static_cast<int>(image.levels.size());
+		stream.next = stream.levels - 1;
+		streams.push_back(std::move(stream));
+	}
+
+	bool empty() const { return pending == 0 && streams.empty(); }
+
+	// Uploads for up to budgetMilliseconds, at least one level when any is ready, true once empty
+	bool poll(double budgetMilliseconds)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto elapsed = [start] {
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+
+		// Without workers the decode jobs only run here
+		if (pending > 0)
+			threadPool().runFor(budgetMilliseconds);
+
+		Decoded decoded;
+		while (pending > 0 && completed.tryPop(decoded))
+		{
+			pending--;
+			accept(decoded);
+		}
+
+		bool uploaded = false;
+		while (!streams.empty() && !(uploaded && elapsed() >= budgetMilliseconds))
+		{
+			nextStream %= streams.size();
+			uploadLevel(streams[nextStream]);
+			uploaded = true;
+			if (streams[nextStream].next < 0)
+				streams.erase(streams.begin() + nextStream);
+			else
+				nextStream++;
+		}
+
+		if (pending == 0)
+			jobs.clear();
+		return empty();
+	}
+
+	// Blocks until every image is uploaded with all its levels
+	void finish()
+	{
+		for (; pending > 0; pending--)
+		{
+			Decoded decoded = completed.pop();
+			accept(decoded);
+		}
+		for (Stream& stream : streams)
+			while (stream.next >= 0)
+				uploadLevel(stream);
+		streams.clear();
+		jobs.clear();
+	}
+
+private:
+	struct Job {
+		GLTexture* texture;
+		GLenum target;
+		std::string filename;
+		GLint layer;
+		int components;
+		bool srgb;
+	};
+
+	struct Decoded {
+		size_t job = 0;
+		DecodedImage image;
+		std::vector<MipLevel> mips;
+	};
+
+	// A 2D texture part way through its levels, either decoded or KTX2
+	struct Stream {
+		GLTexture* texture = nullptr;
+		std::string filename;
+		DecodedImage image;
+		std::vector<MipLevel> mips;
+		std::shared_ptr<std::vector<unsigned char>> compressedBytes;
+		Ktx2Image compressed;
+		int levels = 0;
+		// Level uploaded next, counts down to 0
+		int next = -1;
+	};
+
+	std::vector<Job> jobs;
+	CompletionQueue<Decoded> completed;
+	size_t pending = 0;
+	std::vector<Stream> streams;
+	// Round robin position, carried across polls so a small budget still reaches every stream
+	size_t nextStream = 0;
+
+	void submit(Job job, std::vector<unsigned char> bytes, bool flipVertically)
+	{
+		size_t index = jobs.size();
+		int components = job.components;
+		bool srgb = job.srgb;
+		jobs.push_back(std::move(job));
+		pending++;
+
+		CompletionQueue<Decoded>* queue = &completed;
+		auto shared = std::make_shared<std::vector<unsigned char>>(std::move(bytes));
+		threadPool().submit([queue, index, shared, components, srgb, flipVertically] {
+			Decoded decoded{ index, decodeImage(*shared, flipVertically, components), {} };
+			decoded.mips = buildMipChain(decoded.image, srgb);
+			queue->push(std::move(decoded));
+		});
+	}
+
+	void accept(Decoded& decoded)
+	{
+		const Job& job = jobs[decoded.job];
+		if (!decoded.image.pixels)
+		{
+			std::cout << "Texture failed to load at path: " << job.filename << std::endl;
+			return;
+		}
+		if (job.target == GL_TEXTURE_2D_ARRAY)
+		{
+			uploadArrayLayer(*job.texture, job.layer, decoded.image, decoded.mips);
+			return;
+		}
+		if (job.target != GL_TEXTURE_2D)
+		{
+			uploadCubeMapFace(*job.texture, job.target, decoded.image, decoded.mips);
+			return;
+		}
+
+		Stream stream;
+		stream.texture = job.texture;
+		stream.filename = job.filename;
+		stream.image = std::move(decoded.image);
+		stream.mips = std::move(decoded.mips);
+		stream.levels = static_cast<int>(stream.mips.size()) + 1;
+		stream.next = stream.levels - 1;
+		streams.push_back(std::move(stream));
+	}
+
+	// Lowers GL_TEXTURE_BASE_LEVEL onto the new level, levels base to max are always complete.
+	// The first, smallest, level allocates immutable storage for the whole chain, which
+	// replaces the placeholder
+	static void uploadLevel(Stream& stream)
+	{
+		GLint level = stream.next;
+		glState.bindTexture(GL_TEXTURE_2D, *stream.texture);
+		if (level == stream.levels - 1)
+			allocate(stream);
+
+		if (stream.compressedBytes)
+		{
+			const Ktx2Image& image = stream.compressed;
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, image.width(level), image.height(level), image.glFormat,
+				image.faceBytes(level), image.faceData(level, 0));
+		}
+		else
+		{
+			const DecodedImage& image = stream.image;
+			int width = level == 0 ? image.width : stream.mips[level - 1].width;
+			int height = level == 0 ? image.height : stream.mips[level - 1].height;
+			const unsigned char* pixels = level == 0 ? image.pixels.get() : stream.mips[level - 1].pixels.data();
+			// Rows are tightly packed, RGB and small levels are not 4 byte aligned
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, imageFormat(image), GL_UNSIGNED_BYTE, pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+		stream.next--;
+	}
+
+	static void allocate(Stream& stream)
+	{
+		long long bytes = 0;
+		if (stream.compressedBytes)
+		{
+			const Ktx2Image& image = stream.compressed;
+			glTexStorage2D(GL_TEXTURE_2D, stream.levels, image.glFormat, image.width(0), image.height(0));
+			for (int level = 0; level < stream.levels; level++)
+				bytes += image.faceBytes(level);
+		}
+		else
+		{
+			const DecodedImage& image = stream.image;
+			glTexStorage2D(GL_TEXTURE_2D, stream.levels, storageFormat(image.components), image.width, image.height);
+			bytes = static_cast<long long>(image.width) * image.height * image.components;
+			for (const MipLevel& mip : stream.mips)
+				bytes += static_cast<long long>(mip.width) * mip.height * image.components;
+		}
+		stream.texture->setBytes(bytes);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, stream.levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, stream.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+};
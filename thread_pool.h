@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running jobs in submission order.
+// Web builds only get workers when compiled with pthreads (the USE_THREADS option),
+// otherwise jobs wait in the queue until the main thread runs them, either through
+// runFor once per frame or while it waits on a CompletionQueue.
+// Jobs must not touch GL, the context only lives on the main thread.
+
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned int workerCount = defaultWorkerCount())
+	{
+#if !defined(__EMSCRIPTEN__) || defined(__EMSCRIPTEN_PTHREADS__)
+		for (unsigned int i = 0; i < workerCount; i++)
+			workers.emplace_back([this] { run(); });
+#endif
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Queued jobs still run before the workers are joined
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		available.notify_all();
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	void submit(std::function<void()> job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		available.notify_one();
+	}
+
+	size_t size() const { return workers.size(); }
+
+	// Runs one queued job on the calling thread, false when there was none
+	bool runOne()
+	{
+		std::function<void()> job;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (jobs.empty())
+				return false;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+		return true;
+	}
+
+	// Main thread share of the work when there are no workers, at least one job per call.
+	// Does nothing with workers, a job run here could hold up the frame far past the budget
+	void runFor(double budgetMilliseconds)
+	{
+		if (!workers.empty())
+			return;
+		auto start = std::chrono::steady_clock::now();
+		while (runOne())
+		{
+			if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= budgetMilliseconds)
+				break;
+		}
+	}
+
+	// Every core but the one running the main loop
+	static unsigned int defaultWorkerCount()
+	{
+		unsigned int cores = std::thread::hardware_concurrency();
+		return std::max(1u, cores > 1 ? cores - 1 : 1u);
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable available;
+	bool stopping = false;
+
+	void run()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				available.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			job();
+		}
+	}
+};
+
+// Shared by all loaders, started on first use rather than before main
+inline ThreadPool& threadPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+// Results handed back from workers, popped by the thread that consumes them
+template <typename T>
+class CompletionQueue {
+public:
+	// Notifies under the lock, the consumer may destroy the queue as soon as it has the last result
+	void push(T value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		results.push_back(std::move(value));
+		ready.notify_one();
+	}
+
+	bool tryPop(T& value)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (results.empty())
+			return false;
+		value = std::move(results.front());
+		results.pop_front();
+		return true;
+	}
+
+	// Blocks until a result is available, running queued jobs meanwhile so it cannot
+	// wait on work nobody else would do
+	T pop()
+	{
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!results.empty())
+				{
+					T value = std::move(results.front());
+					results.pop_front();
+					return value;
+				}
+			}
+			if (!threadPool().runOne())
+				break;
+		}
+
+		std::unique_lock<std::mutex> lock(mutex);
+		ready.wait(lock, [this] { return !results.empty(); });
+		T value = std::move(results.front());
+		results.pop_front();
+		return value;
+	}
+
+private:
+	std::deque<T> results;
+	std::mutex mutex;
+	std::condition_variable ready;
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+
+// Minimal ETC2 block encoder for the texture compressor.
+// Colour blocks only use the ETC1 compatible individual and differential modes, which
+// every ETC2 decoder reads, and stay clear of the T, H and planar modes by never letting
+// differential bases overflow. Alpha uses EAC. Each half block is fit exhaustively over
+// the 8 modifier tables around its average colour, quality is close to etcpack's fast mode.
+// Texels are RGBA8 in row order, block[y * 4 + x].
+
+const int ETC_MODIFIERS[8][2] = { {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183} };
+
+const int EAC_MODIFIERS[16][8] = {
+	{ -3, -6, -9, -15, 2, 5, 8, 14 },
+	{ -3, -7, -10, -13, 2, 6, 9, 12 },
+	{ -2, -5, -8, -13, 1, 4, 7, 12 },
+	{ -2, -4, -6, -13, 1, 3, 5, 12 },
+	{ -3, -6, -8, -12, 2, 5, 7, 11 },
+	{ -3, -7, -9, -11, 2, 6, 8, 10 },
+	{ -4, -7, -8, -11, 3, 6, 7, 10 },
+	{ -3, -5, -8, -11, 2, 4, 7, 10 },
+	{ -2, -6, -8, -10, 1, 5, 7, 9 },
+	{ -2, -5, -8, -10, 1, 4, 7, 9 },
+	{ -2, -4, -8, -10, 1, 3, 7, 9 },
+	{ -2, -5, -7, -10, 1, 4, 6, 9 },
+	{ -3, -4, -7, -10, 2, 3, 6, 9 },
+	{ -1, -2, -3, -10, 0, 1, 2, 9 },
+	{ -4, -6, -8, -9, 3, 5, 7, 8 },
+	{ -3, -5, -7, -9, 2, 4, 6, 8 }
+};
+
+inline int etcClamp(int value) { return value < 0 ? 0 : (value > 255 ? 255 : value); }
+
+// Pixel index 0 is +a, 1 +b, 2 -a, 3 -b
+inline int etcModifier(int table, int index)
+{
+	int modifier = ETC_MODIFIERS[table][index & 1];
+	return index & 2 ? -modifier : modifier;
+}
+
+// Column major position of a texel in the index bits
+inline int etcPixelBit(int x, int y) { return x * 4 + y; }
+
+inline bool etcInSecondHalf(int x, int y, bool flip) { return flip ? y >= 2 : x >= 2; }
+
+struct EtcHalfFit {
+	int table = 0;
+	uint32_t error = 0xffffffffu;
+	uint8_t indices[16] = {};
+};
+
+// Best table and per texel index of one half block around base
+inline EtcHalfFit etcFitHalf(const uint8_t block[16][4], bool flip, bool second, const int base[3])
+{
+	EtcHalfFit best;
+	for (int table = 0; table < 8; table++)
+	{
+		EtcHalfFit fit;
+		fit.table = table;
+		fit.error = 0;
+		for (int y = 0; y < 4; y++)
+		{
+			for (int x = 0; x < 4; x++)
+			{
+				if (etcInSecondHalf(x, y, flip) != second)
+					continue;
+
+				const uint8_t* texel = block[y * 4 + x];
+				uint32_t bestError = 0xffffffffu;
+				for (int index = 0; index < 4; index++)
+				{
+					int modifier = etcModifier(table, index);
+					uint32_t error = 0;
+					for (int c = 0; c < 3; c++)
+					{
+						int delta = etcClamp(base[c] + modifier) - texel[c];
+						error += static_cast<uint32_t>(delta * delta);
+					}
+					if (error < bestError)
+					{
+						bestError = error;
+						fit.indices[y * 4 + x] = static_cast<uint8_t>(index);
+					}
+				}
+				fit.error += bestError;
+			}
+		}
+		if (fit.error < best.error)
+			best = fit;
+	}
+	return best;
+}
+
+inline void etcHalfAverage(const uint8_t block[16][4], bool flip, bool second, float average[3])
+{
+	int sum[3] = { 0, 0, 0 };
+	for (int y = 0; y < 4; y++)
+		for (int x = 0; x < 4; x++)
+			if (etcInSecondHalf(x, y, flip) == second)
+				for (int c = 0; c < 3; c++)
+					sum[c] += block[y * 4 + x][c];
+	for (int c = 0; c < 3; c++)
+		average[c] = sum[c] / 8.0f;
+}
+
+inline void writeBigEndian(uint8_t* out, uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+}
+
+// 8 byte ETC2 RGB block
+inline void encodeEtc2Rgb(const uint8_t block[16][4], uint8_t out[8])
+{
+	uint32_t bestError = 0xffffffffu;
+	uint32_t bestHigh = 0;
+	uint32_t bestLow = 0;
+
+	for (int flip = 0; flip < 2; flip++)
+	{
+		float averages[2][3];
+		etcHalfAverage(block, flip != 0, false, averages[0]);
+		etcHalfAverage(block, flip != 0, true, averages[1]);
+
+		for (int differential = 0; differential < 2; differential++)
+		{
+			int codes[2][3];
+			int bases[2][3];
+			bool valid = true;
+			for (int half = 0; half < 2; half++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					if (differential)
+					{
+						codes[half][c] = static_cast<int>(averages[half][c] * 31.0f / 255.0f + 0.5f);
+						bases[half][c] = (codes[half][c] << 3) | (codes[half][c] >> 2);
+					}
+					else
+					{
+						codes[half][c] = static_cast<int>(averages[half][c] * 15.0f / 255.0f + 0.5f);
+						bases[half][c] = codes[half][c] * 17;
+					}
+				}
+			}
+			if (differential)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					int delta = codes[1][c] - codes[0][c];
+					valid = valid && delta >= -4 && delta <= 3;
+				}
+			}
+			if (!valid)
+				continue;
+
+			EtcHalfFit fits[2] = { etcFitHalf(block, flip != 0, false, bases[0]), etcFitHalf(block, flip != 0, true, bases[1]) };
+			uint32_t error = fits[0].error + fits[1].error;
+			if (error >= bestError)
+				continue;
+
+			uint32_t high = 0;
+			for (int c = 0; c < 3; c++)
+			{
+				int shift = 24 - 8 * c;
+				if (differential)
+					high |= static_cast<uint32_t>((codes[0][c] << 3) | ((codes[1][c] - codes[0][c]) & 7)) << shift;
+				else
+					high |= static_cast<uint32_t>((codes[0][c] << 4) | codes[1][c]) << shift;
+			}
+			high |= static_cast<uint32_t>(fits[0].table) << 5;
+			high |= static_cast<uint32_t>(fits[1].table) << 2;
+			high |= static_cast<uint32_t>(differential) << 1;
+			high |= static_cast<uint32_t>(flip);
+
+			uint32_t low = 0;
+			for (int y = 0; y < 4; y++)
+			{
+				for (int x = 0; x < 4; x++)
+				{
+					int index = fits[etcInSecondHalf(x, y, flip != 0) ? 1 : 0].indices[y * 4 + x];
+					int bit = etcPixelBit(x, y);
+					low |= static_cast<uint32_t>(index >> 1) << (16 + bit);
+					low |= static_cast<uint32_t>(index & 1) << bit;
+				}
+			}
+
+			bestError = error;
+			bestHigh = high;
+			bestLow = low;
+		}
+	}
+
+	writeBigEndian(out, (static_cast<uint64_t>(bestHigh) << 32) | bestLow, 8);
+}
+
+// 8 byte EAC block for the alpha channel of ETC2 RGBA8
+inline void encodeEacAlpha(const uint8_t block[16][4], uint8_t out[8])
+{
+	int low = 255, high = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		low = std::min(low, static_cast<int>(block[i][3]));
+		high = std::max(high, static_cast<int>(block[i][3]));
+	}
+
+	uint32_t bestError = 0xffffffffu;
+	int bestBase = low, bestMultiplier = 1, bestTable = 13;
+	uint64_t bestIndices = 0;
+
+	for (int table = 0; table < 16; table++)
+	{
+		int minModifier = EAC_MODIFIERS[table][3];
+		int maxModifier = EAC_MODIFIERS[table][7];
+		int guess = static_cast<int>((high - low) / float(maxModifier - minModifier) + 0.5f);
+		for (int multiplier = std::max(1, guess - 1); multiplier <= std::min(15, guess + 1); multiplier++)
+		{
+			int center = static_cast<int>((high + low) * 0.5f - multiplier * (maxModifier + minModifier) * 0.5f + 0.5f);
+			for (int base = std::max(0, center - 1); base <= std::min(255, center + 1); base++)
+			{
+				uint32_t error = 0;
+				uint64_t indices = 0;
+				for (int x = 0; x < 4; x++)
+				{
+					for (int y = 0; y < 4; y++)
+					{
+						int alpha = block[y * 4 + x][3];
+						uint32_t texelError = 0xffffffffu;
+						int texelIndex = 0;
+						for (int index = 0; index < 8; index++)
+						{
+							int delta = etcClamp(base + EAC_MODIFIERS[table][index] * multiplier) - alpha;
+							if (static_cast<uint32_t>(delta * delta) < texelError)
+							{
+								texelError = static_cast<uint32_t>(delta * delta);
+								texelIndex = index;
+							}
+						}
+						error += texelError;
+						indices = (indices << 3) | static_cast<uint64_t>(texelIndex);
+					}
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					bestBase = base;
+					bestMultiplier = multiplier;
+					bestTable = table;
+					bestIndices = indices;
+				}
+			}
+		}
+	}
+
+	out[0] = static_cast<uint8_t>(bestBase);
+	out[1] = static_cast<uint8_t>((bestMultiplier << 4) | bestTable);
+	writeBigEndian(out + 2, bestIndices, 6);
+}
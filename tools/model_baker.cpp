@@ -0,0 +1,161 @@
+// Offline model baker, turns anything assimp reads into the .wmdl format of mesh_format.h
+// so the web build loads models without assimp or any per vertex work.
+//
+// model_baker <input> <output.wmdl> [--format float|half|snorm16] [--lods N] [--merge]
+//     [--no-optimize] [--profile raw|fast|balanced|quality] [--compare-profiles] [--benchmark N]
+//
+// --compare-profiles imports once with every assimp profile and reports each before baking
+// --benchmark times N loads through assimp against N reads of the baked file, CPU side only
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "../model_import.h"
+#include "../mesh_format.h"
+
+static void printUsage()
+{
+	std::cout << "usage: model_baker <input> <output.wmdl> [--format float|half|snorm16] [--lods N] [--merge]"
+		" [--no-optimize] [--profile raw|fast|balanced|quality] [--compare-profiles] [--benchmark N]" << std::endl;
+}
+
+static bool parseFormat(const char* name, VertexFormat& format)
+{
+	if (std::strcmp(name, "float") == 0)
+		format = VertexFormat::Float;
+	else if (std::strcmp(name, "half") == 0)
+		format = VertexFormat::Half;
+	else if (std::strcmp(name, "snorm16") == 0)
+		format = VertexFormat::Snorm16;
+	else
+		return false;
+	return true;
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		printUsage();
+		return 1;
+	}
+
+	std::string input = argv[1];
+	std::string output = argv[2];
+	ImportOptions options;
+	int benchmarkRuns = 0;
+	bool compareProfiles = false;
+
+	for (int i = 3; i < argc; i++)
+	{
+		bool hasValue = i + 1 < argc;
+		if (std::strcmp(argv[i], "--format") == 0 && hasValue)
+		{
+			if (!parseFormat(argv[++i], options.vertexFormat))
+			{
+				printUsage();
+				return 1;
+			}
+		}
+		else if (std::strcmp(argv[i], "--lods") == 0 && hasValue)
+			options.lodLevels = std::atoi(argv[++i]);
+		else if (std::strcmp(argv[i], "--merge") == 0)
+			options.mergeByMaterial = true;
+		else if (std::strcmp(argv[i], "--no-optimize") == 0)
+			options.optimizeMeshes = false;
+		else if (std::strcmp(argv[i], "--profile") == 0 && hasValue)
+		{
+			if (!parseImportProfile(argv[++i], options.profile))
+			{
+				printUsage();
+				return 1;
+			}
+		}
+		else if (std::strcmp(argv[i], "--compare-profiles") == 0)
+			compareProfiles = true;
+		else if (std::strcmp(argv[i], "--benchmark") == 0 && hasValue)
+			benchmarkRuns = std::atoi(argv[++i]);
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	if (compareProfiles)
+	{
+		for (ImportProfile profile : { ImportProfile::Raw, ImportProfile::Fast, ImportProfile::Balanced, ImportProfile::Quality })
+		{
+			ModelData compared;
+			if (importModel(input, compared, profile))
+				compared.importReport.print(input);
+		}
+	}
+
+	ModelData model;
+	if (!importModel(input, model, options.profile))
+		return 1;
+	model.importReport.print(input);
+	processModelData(model, options);
+
+	if (!writeBakedModel(output, model, options.vertexFormat))
+	{
+		std::cout << "ERROR: could not write " << output << std::endl;
+		return 1;
+	}
+
+	size_t vertices = 0, indices = 0;
+	for (const MeshData& mesh : model.meshes)
+	{
+		vertices += mesh.vertices.size();
+		indices += mesh.indices.size();
+	}
+	std::cout << output << ": " << model.meshes.size() << " meshes, " << vertices << " vertices, "
+		<< indices / 3 << " triangles" << std::endl;
+	if (options.optimizeMeshes)
+		model.optimizeReport.print(input);
+
+	if (benchmarkRuns > 0)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int run = 0; run < benchmarkRuns; run++)
+		{
+			ModelData imported;
+			importModel(input, imported, options.profile);
+			processModelData(imported, options);
+			for (MeshData& mesh : imported.meshes)
+			{
+				float boundsMin[3], boundsMax[3], posScale[3], posOffset[3];
+				computeVertexBounds(mesh.vertices, boundsMin, boundsMax);
+				if (options.vertexFormat != VertexFormat::Float)
+					packVertices(mesh.vertices, options.vertexFormat, boundsMin, boundsMax, posScale, posOffset);
+			}
+		}
+		double importTime = millisecondsSince(start) / benchmarkRuns;
+
+		start = std::chrono::steady_clock::now();
+		for (int run = 0; run < benchmarkRuns; run++)
+		{
+			BakedModel baked;
+			if (!baked.load(output))
+			{
+				std::cout << "ERROR: could not read back " << output << std::endl;
+				return 1;
+			}
+		}
+		double bakedTime = millisecondsSince(start) / benchmarkRuns;
+
+		std::cout << "assimp import and processing: " << importTime << " ms, baked read: " << bakedTime
+			<< " ms (" << importTime / std::max(bakedTime, 1e-6) << "x)" << std::endl;
+	}
+
+	return 0;
+}
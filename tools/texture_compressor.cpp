@@ -0,0 +1,150 @@
+// Offline texture compressor, writes an ETC2 KTX2 next to each input image with its full
+// mip chain. textureCache picks the .ktx2 up in place of the image when the GPU reads ETC2.
+//
+// texture_compressor [--flip] [--no-mips] [--srgb] <images...>
+//
+// --flip stores rows bottom up, for textures the runtime loads flipped (model textures
+// and the skybox), the marble texture is loaded as is.
+// --srgb marks color maps, their mips are filtered in linear space like the runtime does.
+// ASTC is read by the runtime too, compress with an external encoder such as
+// toktx --encode astc without supercompression.
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb_image.h"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../ktx2.h"
+#include "../mip_generator.h"
+#include "etc2_encoder.h"
+
+struct Image {
+	int width = 0;
+	int height = 0;
+	std::vector<uint8_t> rgba;
+
+	const uint8_t* texel(int x, int y) const
+	{
+		x = std::min(x, width - 1);
+		y = std::min(y, height - 1);
+		return &rgba[(static_cast<size_t>(y) * width + x) * 4];
+	}
+};
+
+// Same filter as the runtime loader, sRGB images average their colors in linear space
+static Image downsample(const Image& image, bool srgb)
+{
+	MipLevel level = downsampleLevel(image.rgba.data(), image.width, image.height, 4, srgb);
+	Image half;
+	half.width = level.width;
+	half.height = level.height;
+	half.rgba = std::move(level.pixels);
+	return half;
+}
+
+static std::vector<unsigned char> compress(const Image& image, bool alpha)
+{
+	int blocksX = (image.width + 3) / 4;
+	int blocksY = (image.height + 3) / 4;
+	int blockBytes = alpha ? 16 : 8;
+	std::vector<unsigned char> out(static_cast<size_t>(blocksX) * blocksY * blockBytes);
+
+	for (int by = 0; by < blocksY; by++)
+	{
+		for (int bx = 0; bx < blocksX; bx++)
+		{
+			uint8_t block[16][4];
+			for (int y = 0; y < 4; y++)
+				for (int x = 0; x < 4; x++)
+					std::memcpy(block[y * 4 + x], image.texel(bx * 4 + x, by * 4 + y), 4);
+
+			unsigned char* dst = &out[(static_cast<size_t>(by) * blocksX + bx) * blockBytes];
+			if (alpha)
+			{
+				encodeEacAlpha(block, dst);
+				dst += 8;
+			}
+			encodeEtc2Rgb(block, dst);
+		}
+	}
+	return out;
+}
+
+static bool compressFile(const std::string& input, bool flip, bool mips, bool srgb)
+{
+	stbi_set_flip_vertically_on_load(flip);
+	Image image;
+	int components = 0;
+	unsigned char* pixels = stbi_load(input.c_str(), &image.width, &image.height, &components, 4);
+	if (!pixels)
+	{
+		std::cout << "ERROR: could not read " << input << ": " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	image.rgba.assign(pixels, pixels + static_cast<size_t>(image.width) * image.height * 4);
+	stbi_image_free(pixels);
+
+	// EAC alpha doubles the size, only spent when some texel is not opaque
+	bool alpha = false;
+	if (components == 2 || components == 4)
+		for (size_t i = 3; i < image.rgba.size() && !alpha; i += 4)
+			alpha = image.rgba[i] != 255;
+
+	std::vector<Ktx2LevelData> levels;
+	long long rawBytes = 0;
+	for (Image level = image;; level = downsample(level, srgb))
+	{
+		levels.push_back({ compress(level, alpha) });
+		rawBytes += static_cast<long long>(level.width) * level.height * components;
+		if (!mips || (level.width == 1 && level.height == 1))
+			break;
+	}
+
+	uint32_t vkFormat = alpha ? (srgb ? VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK : VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK)
+		: (srgb ? VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK : VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK);
+	std::string output = ktx2Path(input);
+	if (!writeKtx2(output, vkFormat, image.width, image.height, 1, levels, etc2Descriptor(alpha, srgb), flip))
+	{
+		std::cout << "ERROR: could not write " << output << std::endl;
+		return false;
+	}
+
+	long long compressedBytes = 0;
+	for (const Ktx2LevelData& level : levels)
+		compressedBytes += level.bytes.size();
+	std::cout << output << ": " << image.width << "x" << image.height << (alpha ? " ETC2 RGBA8, " : " ETC2 RGB8, ")
+		<< levels.size() << " levels, " << rawBytes / 1024 << " KB -> " << compressedBytes / 1024 << " KB ("
+		<< static_cast<double>(rawBytes) / compressedBytes << "x)" << std::endl;
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	bool flip = false, mips = true, srgb = false;
+	std::vector<std::string> inputs;
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--flip") == 0)
+			flip = true;
+		else if (std::strcmp(argv[i], "--no-mips") == 0)
+			mips = false;
+		else if (std::strcmp(argv[i], "--srgb") == 0)
+			srgb = true;
+		else
+			inputs.push_back(argv[i]);
+	}
+
+	if (inputs.empty())
+	{
+		std::cout << "usage: texture_compressor [--flip] [--no-mips] [--srgb] <images...>" << std::endl;
+		return 1;
+	}
+
+	bool ok = true;
+	for (const std::string& input : inputs)
+		ok = compressFile(input, flip, mips, srgb) && ok;
+	return ok ? 0 : 1;
+}
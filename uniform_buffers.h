@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstring>
+#include <GLES3/gl3.h>
+
+#include "gl_resource.h"
+#include "stats.h"
+
+// Per frame data shared by every program through std140 uniform blocks, Camera and Lights.
+// Each block name has a fixed binding point, GLSL ES 3.00 has no layout(binding) so
+// ShaderProgram attaches the blocks of a program once after link. The buffers stay bound
+// on those points, written at most once per frame however many programs read them.
+// The structs mirror std140: vec3 members padded to 16 bytes, matrices in
+// mat4::toFloatVector order, read by the shaders exactly like the old mat4 uniforms.
+
+enum UniformBlockBinding {
+	CAMERA_BINDING,
+	LIGHTS_BINDING,
+	UNIFORM_BLOCK_BINDINGS
+};
+
+inline const char* uniformBlockName(int binding)
+{
+	switch (binding)
+	{
+	case CAMERA_BINDING: return "Camera";
+	case LIGHTS_BINDING: return "Lights";
+	default: return "";
+	}
+}
+
+// NR_POINT_LIGHTS in shader.frag
+const int MAX_POINT_LIGHTS = 8;
+
+struct CameraBlock {
+	float vp[16];
+	float view[16];
+	float proj[16];
+	float viewPos[4];
+};
+
+// Scalars fill the padding after each vec3, same order as PointLight in shader.frag
+struct PointLightBlock {
+	float position[3];
+	float constant;
+	float ambient[3];
+	float linear;
+	float diffuse[3];
+	float quadratic;
+	float specular[3];
+	float padding;
+};
+
+struct LightsBlock {
+	PointLightBlock pointLights[MAX_POINT_LIGHTS];
+};
+
+static_assert(sizeof(CameraBlock) == 208, "CameraBlock must match the std140 layout of Camera");
+static_assert(sizeof(LightsBlock) == 64 * MAX_POINT_LIGHTS, "LightsBlock must match the std140 layout of Lights");
+
+// Points the blocks a program declares at their binding points, blocks it lacks are skipped
+inline void bindUniformBlocks(GLuint program)
+{
+	for (int binding = 0; binding < UNIFORM_BLOCK_BINDINGS; binding++)
+	{
+		GLuint index = glGetUniformBlockIndex(program, uniformBlockName(binding));
+		if (index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, index, static_cast<GLuint>(binding));
+	}
+}
+
+// One block's buffer and a CPU copy of its contents. set() only marks it dirty when the
+// contents change, so static data like the lights is uploaded once and then never again
+template <typename Block>
+class UniformBuffer {
+public:
+	// Allocates the buffer and binds it on its point for good
+	void create(UniformBlockBinding binding)
+	{
+		buffer = createGLBuffer();
+		uploadBuffer(buffer, GL_UNIFORM_BUFFER, sizeof(Block), &block, GL_DYNAMIC_DRAW);
+		glState.bindBufferBase(GL_UNIFORM_BUFFER, static_cast<GLuint>(binding), buffer);
+		dirty = false;
+	}
+
+	void set(const Block& contents)
+	{
+		if (std::memcmp(&block, &contents, sizeof(Block)) == 0)
+			return;
+		block = contents;
+		dirty = true;
+	}
+
+	const Block& get() const { return block; }
+
+	// Writes the block if it changed since the last upload, true when it did
+	bool upload()
+	{
+		if (!dirty || !buffer.get())
+			return false;
+		glState.bindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+		frameStats.glCalls++;
+		frameStats.uniformBufferUploads++;
+		dirty = false;
+		return true;
+	}
+
+private:
+	Block block = {};
+	GLBuffer buffer;
+	bool dirty = false;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <GLES3/gl3.h>
+
+#include "quantize.h"
+
+struct Vertex {
+	float Pos[3];
+	float Colors[3] = { 1.0, 1.0, 1.0 };
+	float TexUV[2];
+	float Normal[3];
+	// xyz along increasing U, w the bitangent sign, bitangent = cross(Normal, Tangent) * w
+	float Tangent[4] = { 1.0, 0.0, 0.0, 1.0 };
+};
+
+// Float vertices carry their tangent here, locations 4 to 7 are the instance transform
+const GLuint TANGENT_ATTRIBUTE = 8;
+
+// Layout used for the GPU copy of a mesh, CPU side always keeps full Vertex data
+enum class VertexFormat {
+	Float,   // 60 bytes, Vertex as is
+	Half,    // 24 bytes, half positions, snorm16 QTangent frames, unorm8 colors, half UVs
+	Snorm16  // 24 bytes, same as Half but snorm16 positions dequantized with the mesh bounds
+};
+
+struct PackedVertex {
+	uint16_t Pos[3];
+	uint16_t pad;
+	uint8_t Colors[4];
+	uint16_t TexUV[2];
+	// Normal, tangent and bitangent sign as one quaternion, see encodeQTangent
+	int16_t QTangent[4];
+};
+static_assert(sizeof(PackedVertex) == 24, "PackedVertex must stay tightly packed");
+
+inline GLsizei vertexStride(VertexFormat format)
+{
+	return format == VertexFormat::Float ? sizeof(Vertex) : sizeof(PackedVertex);
+}
+
+// Attribute pointers for the currently bound VAO and GL_ARRAY_BUFFER
+inline void setVertexAttributes(VertexFormat format)
+{
+	if (format == VertexFormat::Float)
+	{
+		// Set Vertex attrib ptr
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+
+		// Set Color attrib
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Colors));
+
+		// Set TexUV ptr
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexUV));
+
+		// Set normal ptr
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+
+		glEnableVertexAttribArray(TANGENT_ATTRIBUTE);
+		glVertexAttribPointer(TANGENT_ATTRIBUTE, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+	}
+	else
+	{
+		// Positions, half floats or snorm16 in the mesh bounds
+		glEnableVertexAttribArray(0);
+		if (format == VertexFormat::Snorm16)
+			glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)0);
+		else
+			glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)0);
+
+		// Colors unorm8
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Colors));
+
+		// TexUV half floats
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexUV));
+
+		// QTangent in place of the normal, the whole tangent frame in 8 bytes
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 4, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, QTangent));
+	}
+}
+
+// Index range of one level of detail, all levels share the vertex buffer.
+// error is relative to the largest side of the mesh bounds
+struct MeshLod {
+	GLsizei first;
+	GLsizei count;
+	float error;
+};
+
+inline void computeVertexBounds(const std::vector<Vertex>& vertices, float boundsMin[3], float boundsMax[3])
+{
+	if (vertices.empty())
+		return;
+
+	for (int c = 0; c < 3; c++)
+	{
+		boundsMin[c] = vertices[0].Pos[c];
+		boundsMax[c] = vertices[0].Pos[c];
+	}
+	for (const Vertex& vertex : vertices)
+	{
+		for (int c = 0; c < 3; c++)
+		{
+			boundsMin[c] = std::min(boundsMin[c], vertex.Pos[c]);
+			boundsMax[c] = std::max(boundsMax[c], vertex.Pos[c]);
+		}
+	}
+}
+
+// Converts to a compact format, posScale and posOffset receive the dequantization
+// the vertex shader applies, pos = packed * posScale + posOffset
+inline std::vector<PackedVertex> packVertices(const std::vector<Vertex>& vertices, VertexFormat format,
+	const float boundsMin[3], const float boundsMax[3], float posScale[3], float posOffset[3])
+{
+	std::vector<PackedVertex> packed(vertices.size());
+
+	for (int c = 0; c < 3; c++)
+	{
+		if (format == VertexFormat::Snorm16)
+		{
+			// Map the bounds onto [-1, 1], flat axes keep a unit scale
+			float halfExtent = 0.5f * (boundsMax[c] - boundsMin[c]);
+			posOffset[c] = 0.5f * (boundsMax[c] + boundsMin[c]);
+			posScale[c] = halfExtent > 0.0f ? halfExtent : 1.0f;
+		}
+		else
+		{
+			posOffset[c] = 0.0f;
+			posScale[c] = 1.0f;
+		}
+	}
+
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const Vertex& vertex = vertices[i];
+		PackedVertex& out = packed[i];
+
+		for (int c = 0; c < 3; c++)
+		{
+			if (format == VertexFormat::Snorm16)
+				out.Pos[c] = static_cast<uint16_t>(floatToSnorm16((vertex.Pos[c] - posOffset[c]) / posScale[c]));
+			else
+				out.Pos[c] = floatToHalf(vertex.Pos[c]);
+
+			out.Colors[c] = floatToUnorm8(vertex.Colors[c]);
+		}
+		out.pad = 0;
+		out.Colors[3] = 255;
+
+		out.TexUV[0] = floatToHalf(vertex.TexUV[0]);
+		out.TexUV[1] = floatToHalf(vertex.TexUV[1]);
+
+		float qtangent[4];
+		encodeQTangent(vertex.Normal, vertex.Tangent, qtangent);
+		for (int c = 0; c < 4; c++)
+			out.QTangent[c] = floatToSnorm16(qtangent[c]);
+	}
+
+	return packed;
+}